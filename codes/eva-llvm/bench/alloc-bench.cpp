@@ -0,0 +1,76 @@
+/*
+  Allocation benchmark: object churn, with the inline nursery
+  allocation and with a runtime (collector) call per object.
+
+  Build:
+    clang++ -O2 -o ./bin/alloc-bench `llvm-config --cxxflags --ldflags --system-libs --libs core passes orcjit all-targets` -std=c++17 -fexceptions bench/alloc-bench.cpp
+
+  Run:
+    ./bin/alloc-bench [objects count]
+
+  The programs run with the JIT, on libgc when it is installed
+  (malloc otherwise, see EvaJIT).
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "../src/EvaLLVM.h"
+
+/*
+  Allocates `count` short-lived points in a loop.
+*/
+std::string generateProgram(size_t count) {
+  return "(class Point null\n"
+         "  (begin\n"
+         "    (var x 0)\n"
+         "    (var y 0)\n"
+         "    (def constructor (self x y) (begin (set (prop self x) x) (set (prop self y) y) 0))))\n"
+         "(def churn (n) (begin\n"
+         "  (var i 0)\n"
+         "  (var sum 0)\n"
+         "  (while (< i n) (begin\n"
+         "    (var p (new Point i 1))\n"
+         "    (set sum (+ sum (prop p y)))\n"
+         "    (set i (+ i 1))))\n"
+         "  sum))\n"
+         "(printf \"allocated: %d\\n\" (churn " + std::to_string(count) + "))\n";
+}
+
+/*
+  Compiles and runs the program, prints the timing.
+*/
+void bench(const char* label, const std::string& program, size_t count, bool inlineAllocation) {
+  CompilerOptions options;
+  options.optLevel = 2;
+  options.inlineAllocation = inlineAllocation;
+
+  // the points don't escape: keep them on the heap
+  options.stackAllocate = false;
+
+  EvaLLVM vm(options);
+
+  auto start = std::chrono::steady_clock::now();
+  vm.execJIT(program);
+  auto end = std::chrono::steady_clock::now();
+
+  auto ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+  std::cout << label << ": " << ms << " ms, "
+            << count / (ms / 1000.0) / 1e6 << " M objects/s\n";
+}
+
+int main(int argc, char const* argv[]) {
+  size_t count = argc > 1 ? std::atoi(argv[1]) : 5000000;
+
+  auto program = generateProgram(count);
+
+  std::cout << "objects: " << count << "\n";
+
+  bench("call per object", program, count, /* inline allocation */ false);
+  bench("nursery", program, count, /* inline allocation */ true);
+
+  return 0;
+}
@@ -0,0 +1,114 @@
+/*
+  Array benchmark: sums of `count` numbers, stored in an array
+  and in a linked list of objects (the way arrays were modeled).
+
+  Build:
+    clang++ -O2 -o ./bin/array-bench `llvm-config --cxxflags --ldflags --system-libs --libs core passes orcjit all-targets` -std=c++17 -fexceptions bench/array-bench.cpp
+
+  Run:
+    ./bin/array-bench [elements count] [passes]
+
+  The programs run with the JIT, on libgc when it is installed
+  (malloc otherwise, see EvaJIT).
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "../src/EvaLLVM.h"
+
+/*
+  Fills an array, then sums it `passes` times.
+*/
+std::string generateArrayProgram(size_t count, size_t passes) {
+  return "(def fill ((a (array i64))) (begin\n"
+         "  (var i 0)\n"
+         "  (while (< i (len a)) (begin\n"
+         "    (aset a i i)\n"
+         "    (set i (+ i 1))))\n"
+         "  0))\n"
+         "(def total ((a (array i64))) -> i64 (begin\n"
+         "  (var (sum i64) 0)\n"
+         "  (var i 0)\n"
+         "  (while (< i (len a)) (begin\n"
+         "    (set sum (+ sum (aref a i)))\n"
+         "    (set i (+ i 1))))\n"
+         "  sum))\n"
+         "(var (a (array i64)) (new-array i64 " + std::to_string(count) + "))\n"
+         "(fill a)\n"
+         "(var (sum i64) 0)\n"
+         "(var pass 0)\n"
+         "(while (< pass " + std::to_string(passes) + ") (begin\n"
+         "  (set sum (+ sum (total a)))\n"
+         "  (set pass (+ pass 1))))\n"
+         "(printf \"sum: %lld\\n\" sum)\n";
+}
+
+/*
+  Same with a linked list of nodes.
+*/
+std::string generateListProgram(size_t count, size_t passes) {
+  return "(class Node null\n"
+         "  (begin\n"
+         "    (var (v i64) 0)\n"
+         "    (var (next Node) 0)\n"
+         "    (def constructor (self (v i64)) (begin (set (prop self v) v) 0))))\n"
+         "(def node ((v i64)) -> Node (new Node v))\n"
+         "(def fill ((n i32)) -> Node (begin\n"
+         "  (var (head Node) (node 0))\n"
+         "  (var i 1)\n"
+         "  (while (< i n) (begin\n"
+         "    (var (next Node) (node i))\n"
+         "    (set (prop next next) head)\n"
+         "    (set head next)\n"
+         "    (set i (+ i 1))))\n"
+         "  head))\n"
+         "(def total ((l Node) (n i32)) -> i64 (begin\n"
+         "  (var (sum i64) 0)\n"
+         "  (var i 0)\n"
+         "  (while (< i n) (begin\n"
+         "    (set sum (+ sum (prop l v)))\n"
+         "    (set l (prop l next))\n"
+         "    (set i (+ i 1))))\n"
+         "  sum))\n"
+         "(var (l Node) (fill " + std::to_string(count) + "))\n"
+         "(var (sum i64) 0)\n"
+         "(var pass 0)\n"
+         "(while (< pass " + std::to_string(passes) + ") (begin\n"
+         "  (set sum (+ sum (total l " + std::to_string(count) + ")))\n"
+         "  (set pass (+ pass 1))))\n"
+         "(printf \"sum: %lld\\n\" sum)\n";
+}
+
+/*
+  Compiles and runs the program, prints the timing.
+*/
+void bench(const char* label, const std::string& program, size_t elements) {
+  CompilerOptions options;
+  options.optLevel = 3;
+
+  EvaLLVM vm(options);
+
+  auto start = std::chrono::steady_clock::now();
+  vm.execJIT(program);
+  auto end = std::chrono::steady_clock::now();
+
+  auto ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+  std::cout << label << ": " << ms << " ms, "
+            << elements / (ms / 1000.0) / 1e6 << " M elements/s\n";
+}
+
+int main(int argc, char const* argv[]) {
+  size_t count = argc > 1 ? std::atoi(argv[1]) : 1000000;
+  size_t passes = argc > 2 ? std::atoi(argv[2]) : 100;
+
+  std::cout << "elements: " << count << ", passes: " << passes << "\n";
+
+  bench("linked list", generateListProgram(count, passes), count * passes);
+  bench("array", generateArrayProgram(count, passes), count * passes);
+
+  return 0;
+}
@@ -0,0 +1,81 @@
+/*
+  Closure benchmark: a callback applied to each element of an array,
+  passed as a callable class instance and as a lambda.
+
+  Build:
+    clang++ -O2 -o ./bin/closure-bench `llvm-config --cxxflags --ldflags --system-libs --libs core passes orcjit all-targets` -std=c++17 -fexceptions bench/closure-bench.cpp
+
+  Run:
+    ./bin/closure-bench [elements count] [passes]
+
+  The programs run with the JIT, on libgc when it is installed
+  (malloc otherwise, see EvaJIT).
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "../src/EvaLLVM.h"
+
+/*
+  The callback is an instance of a class, called through its vTable.
+*/
+std::string generateClassProgram(size_t count, size_t passes) {
+  return "(class Scale null\n"
+         "  (begin\n"
+         "    (var k 0)\n"
+         "    (def constructor (self k) (begin (set (prop self k) k) 0))\n"
+         "    (def apply (self x) (+ (* x (prop self k)) 1))))\n"
+         "(def map ((a (array i32)) (f Scale)) (begin\n"
+         "  (for (i 0 (len a)) (aset a i ((method f apply) f (aref a i))))\n"
+         "  0))\n"
+         "(var (a (array i32)) (new-array i32 " + std::to_string(count) + "))\n"
+         "(for (pass 0 " + std::to_string(passes) + ") (map a (new Scale 3)))\n"
+         "(printf \"a[1]: %d\\n\" (aref a 1))\n";
+}
+
+/*
+  Same with a lambda capturing the factor.
+*/
+std::string generateLambdaProgram(size_t count, size_t passes) {
+  return "(def map ((a (array i32)) (f (fn i32 i32))) (begin\n"
+         "  (for (i 0 (len a)) (aset a i (f (aref a i))))\n"
+         "  0))\n"
+         "(var (a (array i32)) (new-array i32 " + std::to_string(count) + "))\n"
+         "(var k 3)\n"
+         "(for (pass 0 " + std::to_string(passes) + ") (map a (lambda (x) (+ (* x k) 1))))\n"
+         "(printf \"a[1]: %d\\n\" (aref a 1))\n";
+}
+
+/*
+  Compiles and runs the program, prints the timing.
+*/
+void bench(const char* label, const std::string& program, size_t elements) {
+  CompilerOptions options;
+  options.optLevel = 2;
+
+  EvaLLVM vm(options);
+
+  auto start = std::chrono::steady_clock::now();
+  vm.execJIT(program);
+  auto end = std::chrono::steady_clock::now();
+
+  auto ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+  std::cout << label << ": " << ms << " ms, "
+            << elements / (ms / 1000.0) / 1e6 << " M elements/s\n";
+}
+
+int main(int argc, char const* argv[]) {
+  size_t count = argc > 1 ? std::atoi(argv[1]) : 1000000;
+  size_t passes = argc > 2 ? std::atoi(argv[2]) : 100;
+
+  std::cout << "elements: " << count << ", passes: " << passes << "\n";
+
+  bench("callable class", generateClassProgram(count, passes), count * passes);
+  bench("lambda", generateLambdaProgram(count, passes), count * passes);
+
+  return 0;
+}
@@ -0,0 +1,100 @@
+/*
+  Compile-time benchmark: parsing and lowering to LLVM IR.
+
+  Build:
+    clang++ -O2 -o ./bin/compile-bench `llvm-config --cxxflags --ldflags --system-libs --libs core passes orcjit all-targets` -std=c++17 -fexceptions bench/compile-bench.cpp
+
+  Run:
+    ./bin/compile-bench [functions count]
+
+  Also checks that streaming mode generates the same IR.
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <sys/resource.h>
+
+#include "../src/EvaLLVM.h"
+
+/*
+  Generates a program with `count` functions, each with
+  nested blocks, local variables, calls and assignments,
+  and instances and lambdas used by the next forms.
+*/
+std::string generateProgram(size_t count) {
+  std::string program =
+      "(class Point null (begin (var x 0)\n"
+      "  (def constructor (self x) (begin (set (prop self x) x) 0))\n"
+      "  (def get (self) (prop self x))))\n"
+      "(def apply ((f (fn i32 i32)) x) (f x))\n";
+
+  for (size_t i = 0; i < count; i++) {
+    auto n = std::to_string(i);
+
+    program += "(def f" + n + " (a b) (begin\n"
+               "  (var x (+ a " + n + "))\n"
+               "  (var y (* b x))\n"
+               "  (begin (var z (- y a)) (set x (+ x z)))\n"
+               "  (if (> x y) x (f" + n + " (- a 1) b))))\n"
+               "(var v" + n + " (f" + n + " " + n + " 2))\n"
+               "(set v" + n + " (+ v" + n + " VERSION))\n";
+  }
+
+  for (size_t i = 0; i < count / 100; i++) {
+    auto n = std::to_string(i);
+
+    program += "(var p" + n + " (new Point " + n + "))\n"
+               "(var sq" + n + " (lambda (x) (* x x)))\n"
+               "(printf \"%d %d %d\\n\" ((method p" + n + " get) p" + n + ") (sq" + n + " 2) (apply sq" + n + " 3))\n";
+  }
+
+  return program;
+}
+
+/*
+  Compiles the program and prints the timing, returns the IR.
+*/
+std::string bench(const char* label, const std::string& program, bool stream) {
+  CompilerOptions options;
+  options.stream = stream;
+
+  EvaLLVM vm(options);
+
+  auto start = std::chrono::steady_clock::now();
+  vm.compileProgram(program);
+  auto end = std::chrono::steady_clock::now();
+
+  auto ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+  std::cout << label << ": " << ms << " ms, "
+            << (program.size() / (1024.0 * 1024.0)) / (ms / 1000.0)
+            << " MB/s\n";
+
+  return vm.getModuleIR();
+}
+
+int main(int argc, char const* argv[]) {
+  size_t count = argc > 1 ? std::atoi(argv[1]) : 20000;
+
+  auto program = generateProgram(count);
+
+  std::cout << "functions: " << count << ", input: "
+            << program.size() / 1024 << " KB\n";
+
+  auto ir = bench("compile", program, /* stream */ false);
+  auto streamIR = bench("compile (stream)", program, /* stream */ true);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  std::cout << "peak RSS: " << usage.ru_maxrss << " KB\n";
+
+  if (ir != streamIR) {
+    std::cout << "streaming IR differs from the batch IR\n";
+    return 1;
+  }
+
+  return 0;
+}
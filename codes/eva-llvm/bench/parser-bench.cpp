@@ -0,0 +1,106 @@
+/*
+  Tokenizer / parser throughput benchmark.
+
+  Build:
+    clang++ -O2 -std=c++17 -o ./bin/parser-bench bench/parser-bench.cpp
+
+  Run:
+    ./bin/parser-bench [size in KB]
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include <sys/resource.h>
+
+#include "../src/parser/EvaParser.h"
+
+using syntax::EvaParser;
+using syntax::TokenType;
+using syntax::Tokenizer;
+
+/*
+  Heap allocations counter.
+*/
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+  allocations++;
+  if (auto ptr = std::malloc(size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+/*
+  Generates a synthetic Eva program of roughly `size` bytes.
+  Mixes all token classes: lists, symbols, numbers, strings,
+  whitespace and both comment styles.
+*/
+std::string generateProgram(size_t size) {
+  std::string program;
+  program.reserve(size + 256);
+
+  auto i = 0;
+  while (program.size() < size) {
+    auto n = std::to_string(i++);
+    program += "// form " + n + "\n";
+    program += "(def fn" + n + " (x y)\n";
+    program += "  /* body */ (begin\n";
+    program += "    (var z (+ x " + n + "))\n";
+    program += "    (printf \"value: %d\\n\" (* z y))))\n\n";
+  }
+
+  return program;
+}
+
+template <typename Fn>
+double measure(const std::string& label, size_t bytes, Fn&& fn) {
+  auto allocationsBefore = allocations;
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  auto end = std::chrono::steady_clock::now();
+
+  double seconds = std::chrono::duration<double>(end - start).count();
+  double mbs = (bytes / (1024.0 * 1024.0)) / seconds;
+
+  std::cout << label << ": " << seconds * 1000 << " ms, " << mbs << " MB/s, "
+            << allocations - allocationsBefore << " allocations\n";
+  return mbs;
+}
+
+int main(int argc, char const *argv[]) {
+  size_t sizeKB = argc > 1 ? std::stoul(argv[1]) : 256;
+
+  auto program = generateProgram(sizeKB * 1024);
+
+  std::cout << "input: " << program.size() / 1024 << " KB\n";
+
+  measure("tokenize", program.size(), [&]() {
+    Tokenizer tokenizer;
+    tokenizer.initString(program);
+    size_t count = 0;
+    while (tokenizer.getNextToken().type != TokenType::__EOF) {
+      count++;
+    }
+    std::cout << "tokens: " << count << "\n";
+  });
+
+  measure("parse", program.size(), [&]() {
+    EvaParser parser;
+    auto ast = parser.parseProgram(program);
+    std::cout << "forms: " << ast.list.size() - 1 << "\n";
+  });
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  std::cout << "peak RSS: " << usage.ru_maxrss << " KB\n";
+
+  return 0;
+}
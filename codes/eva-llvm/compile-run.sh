@@ -1,22 +1,30 @@
 # /bin/zsh
 # compile main file.
-clang++ -o ./bin/eva-llvm.o `llvm-config --cxxflags --ldflags --system-libs --libs core` eva-llvm.cpp
+clang++ -o ./bin/eva-llvm.o `llvm-config --cxxflags --ldflags --system-libs --libs core passes orcjit all-targets` -std=c++17 -fexceptions eva-llvm.cpp
 
-# run main executable
-./bin/eva-llvm.o -f test.eva
+# run main executable (optimizes the IR and emits ./bin/out.o in-process)
+./bin/eva-llvm.o -O3 -c -f test.eva
 
 # execute generated IR.
 # lli ./out.ll
 
-# optimize the output:
-opt ./bin/out.ll -O3 -S -o ./bin/out-opt.ll
+# or compile and run in-process with the JIT:
+# ./bin/eva-llvm.o -j -O3 -f test.eva
 
-# compile ./out.ll with GC:
+# compile the runtime (object allocation)
+clang++ -O2 -std=c++17 -c src/runtime/EvaRuntime.cpp -o ./bin/EvaRuntime.o
+
+# link ./bin/out.o with the runtime and GC:
 # to install GC_malloc: bre install libgc
-clang++ -O3 -I/opt/homebrew/Cellar/gc/ ./bin/out-opt.ll /opt/homebrew/Cellar/bdw-gc/8.2.8/lib/libgc.a -o ./bin/out.o
+cc ./bin/out.o ./bin/EvaRuntime.o /opt/homebrew/Cellar/bdw-gc/8.2.8/lib/libgc.a -o ./bin/out
+
+# or, with the Eva precise collector instead of libgc (--precise-gc):
+# ./bin/eva-llvm.o -O3 --precise-gc -c -f test.eva
+# clang++ -O2 -std=c++17 -c src/runtime/EvaGC.cpp -o ./bin/EvaGC.o
+# clang++ -no-pie ./bin/out.o ./bin/EvaGC.o -o ./bin/out
 
 # run compiled program
-./bin/out.o
+./bin/out
 
 # print result
 echo $?
@@ -3,54 +3,168 @@
 */
 
 #include <string>
+#include <string_view>
 #include <iostream>
 #include <fstream>
+#include <memory>
 
 #include "./src/EvaLLVM.h"
+#include "./src/SourceFile.h"
 
 void printHelp() {
-  std::cout << "\nUsage: eva-llvm [option]\n\n"
+  std::cout << "\nUsage: eva-llvm [options] -e <expression> | -f <file>\n\n"
             << "Options:\n"
             << "    -e, --expression  Expression to parse\n"
-            << "    -f, --file        File to parse\n\n";
+            << "    -f, --file        File to parse\n"
+            << "    -s, --stream      Compile top-level forms one by one while parsing\n"
+            << "    -j, --jit         Run the program in-process instead of saving the IR\n"
+            << "    -c, --compile     Also emit a native object file ./bin/out.o\n"
+            << "    --target          Target triple (default: the host)\n"
+            << "    -O0 .. -O3        Optimization level (default -O0)\n"
+            << "    --fast-math       Allow unsafe f64 optimizations (reassociation, etc.)\n"
+            << "    --no-stack-alloc  Allocate all instances with the GC, even if they don't escape\n"
+            << "    --no-nursery      Call the runtime for each instance, instead of the inline nursery\n"
+            << "    --precise-gc      Use the Eva generational collector (runtime/EvaGC.cpp) instead\n"
+            << "                      of libgc: statepoints and stack maps, with -c only\n"
+            << "    --loop-tail-calls Compile self tail calls to loops, even at -O0\n"
+            << "    --const-eval-steps <n>\n"
+            << "                      Steps of the compile-time evaluation of a constant\n"
+            << "    --layout-opt      Reorder class fields to reduce padding\n"
+            << "    --layout-profile  Field access counts (lines of \"<class>.<field> <count>\"),\n"
+            << "                      hot fields are placed next to the vTable pointer\n\n";
+}
+
+/*
+  Reads a field access profile.
+*/
+void loadFieldProfile(const std::string& fileName, CompilerOptions& options) {
+  std::ifstream profile(fileName);
+
+  if (!profile) {
+    DIE << "Cannot open file \"" << fileName << "\"." << std::endl;
+  }
+
+  std::string field;
+  uint64_t count;
+
+  while (profile >> field >> count) {
+    options.fieldProfile[field] += count;
+  }
 }
 
 int main(int argc, char const *argv[])
 { 
+  // compiler options
+  CompilerOptions options;
 
-  if (argc != 3) {
-    printHelp();
-    return 0;
-  }
+  // program to execute: a view of the expression
+  // or of the memory mapped file
+  std::string_view program;
+  std::unique_ptr<SourceFile> programFile;
+  bool hasProgram = false;
 
-  // expression mode
-  std::string mode = argv[1];
+  // run with the JIT
+  bool jit = false;
 
-  // program to execute
-  std::string program;
+  for (auto i = 1; i < argc; i++) {
+    std::string arg = argv[i];
 
-  // simple expression
-  if (mode == "-e") {
-    program = argv[2];
-  }
+    // simple expression
+    if ((arg == "-e" || arg == "--expression") && i + 1 < argc) {
+      program = argv[++i];
+      hasProgram = true;
+    }
+
+    /*
+      eva file
+    */
+    else if ((arg == "-f" || arg == "--file") && i + 1 < argc) {
+      programFile = std::make_unique<SourceFile>(argv[++i]);
+
+      // program
+      program = programFile->text();
+      hasProgram = true;
+    }
+
+    // streaming compilation
+    else if (arg == "-s" || arg == "--stream") {
+      options.stream = true;
+    }
+
+    // JIT execution
+    else if (arg == "-j" || arg == "--jit") {
+      jit = true;
+    }
 
-  /*
-    eva file
-  */
-  else if (mode == "-f") {
-    std::ifstream programFile(argv[2]);
-    std::stringstream buffer;
-    buffer << programFile.rdbuf() << "\n";
+    // native code
+    else if (arg == "-c" || arg == "--compile") {
+      options.emitObject = true;
+    }
 
-    // program
-    program = buffer.str();
+    else if (arg == "--target" && i + 1 < argc) {
+      options.targetTriple = argv[++i];
+    }
+
+    // optimization level
+    else if (arg.size() == 3 && arg[0] == '-' && arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '3') {
+      options.optLevel = arg[2] - '0';
+    }
+
+    else if (arg == "--fast-math") {
+      options.fastMath = true;
+    }
+
+    else if (arg == "--no-stack-alloc") {
+      options.stackAllocate = false;
+    }
+
+    else if (arg == "--no-nursery") {
+      options.inlineAllocation = false;
+    }
+
+    else if (arg == "--precise-gc") {
+      options.preciseGC = true;
+    }
+
+    else if (arg == "--loop-tail-calls") {
+      options.loopTailCalls = true;
+    }
+
+    else if (arg == "--const-eval-steps" && i + 1 < argc) {
+      options.constEvalSteps = std::stoull(argv[++i]);
+    }
+
+    // field layout
+    else if (arg == "--layout-opt") {
+      options.optimizeLayout = true;
+    }
+
+    else if (arg == "--layout-profile" && i + 1 < argc) {
+      loadFieldProfile(argv[++i], options);
+      options.optimizeLayout = true;
+    }
+
+    else {
+      printHelp();
+      return 0;
+    }
+  }
+
+  if (!hasProgram) {
+    printHelp();
+    return 0;
   }
 
   // compiler instance
-  EvaLLVM vm;
+  EvaLLVM vm(options);
+
+  // run in-process, the exit code is the result of main
+  if (jit) {
+    return vm.execJIT(program);
+  }
 
   // generate LLVM IR
   vm.exec(program);
 
   return 0;
-}
\ No newline at end of file
+}
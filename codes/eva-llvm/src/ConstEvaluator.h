@@ -0,0 +1,686 @@
+/*
+    ConstEvaluator: evaluates expressions at compile time, run on the
+    resolved AST for the (const <name> <exp>) bindings and the calls
+    with constant args.
+
+    It interprets a pure subset: numbers, booleans, the arithmetic and
+    comparison operators, if, while, begin, locals (var, set), the
+    constants and calls to the functions of the subset. Values have
+    the types the code generator gives them (i32 unless wider, i64,
+    f64 and booleans), so the results are the ones the compiled code
+    computes: integers wrap, a division by zero is not a constant.
+    Each evaluation has a budget of steps and a call depth, a loop
+    which doesn't end makes the expression non-constant. The calls
+    which fail are remembered with their args, and not tried again.
+
+    The functions of the subset are copied to an arena of their own
+    (in streaming mode the AST of a form is freed once it's compiled),
+    the others are checked once and dropped.
+*/
+#ifndef ConstEvaluator_h
+#define ConstEvaluator_h
+
+#include <cstdint>
+#include <cmath>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "./parser/Exp.h"
+
+// types of the compile-time values: i1, i32, i64, f64
+enum class ConstType : uint8_t {
+    BOOL,
+    I32,
+    I64,
+    F64,
+};
+
+struct ConstValue {
+    ConstType type;
+
+    // booleans are 0 or 1
+    union {
+        int64_t integer;
+        double decimal;
+    };
+};
+
+class ConstEvaluator {
+public:
+    // registers a function, (def <name> <params> [-> <type>] <body>),
+    // if it's in the subset
+    void defineFunction(const Exp& fnExp) {
+        auto slot = fnExp.list[1].slot;
+
+        functions_.erase(slot);
+        failedCalls_.erase(failedCalls_.lower_bound({slot}), failedCalls_.lower_bound({slot + 1}));
+
+        if (!isPureFunction(fnExp)) {
+            return;
+        }
+
+        auto copy = copyExp(fnExp);
+        functions_[slot] = &arena_.makeList(&copy, 1)[0];
+    }
+
+    // binds the value of a constant to its slot
+    void defineConstant(uint32_t slot, ConstValue value) { constants_[slot] = value; }
+
+    // value of an expression, none if it's not constant
+    // or takes more than `budget` steps
+    std::optional<ConstValue> evaluate(const Exp& exp, uint64_t budget) {
+        steps_ = budget;
+        depth_ = 0;
+
+        Frame frame;
+        return eval(exp, frame);
+    }
+
+    // value of a call of a known function with constant args, the
+    // calls which failed (for the same budget) are not tried again
+    std::optional<ConstValue> evaluateCall(const Exp& exp, uint64_t budget) {
+        auto fnSlot = exp.list[0].slot;
+
+        if (!functions_.count(fnSlot)) {
+            return std::nullopt;
+        }
+
+        steps_ = budget;
+        depth_ = 0;
+
+        Frame frame;
+        std::vector<ConstValue> args;
+
+        for (auto i = 1; i < exp.list.size(); i++) {
+            auto arg = eval(exp.list[i], frame);
+            if (!arg) {
+                return std::nullopt;
+            }
+            args.push_back(*arg);
+        }
+
+        // the function and the args, as (type, bits)
+        std::vector<int64_t> key{fnSlot};
+        for (const auto& arg : args) {
+            key.push_back((int64_t)arg.type);
+            key.push_back(arg.integer);
+        }
+
+        if (failedCalls_.count(key)) {
+            return std::nullopt;
+        }
+
+        // the args may have dropped it
+        std::optional<ConstValue> result;
+        auto it = functions_.find(fnSlot);
+        if (it != functions_.end()) {
+            result = call(*it->second, args);
+        }
+
+        if (!result) {
+            failedCalls_.insert(std::move(key));
+        }
+
+        return result;
+    }
+
+private:
+    // values of the locals of a call, by slot
+    using Frame = std::vector<std::pair<uint32_t, ConstValue>>;
+
+    std::optional<ConstValue> eval(const Exp& exp, Frame& frame) {
+        if (steps_ == 0) {
+            return std::nullopt;
+        }
+        steps_--;
+
+        switch (exp.type) {
+            case ExpType::NUMBER:
+                return exp.number != (int32_t)exp.number ? makeInt(ConstType::I64, exp.number)
+                                                         : makeInt(ConstType::I32, exp.number);
+
+            case ExpType::FLOAT:
+                return makeFloat(exp.decimal);
+
+            case ExpType::STRING:
+                return std::nullopt;
+
+            case ExpType::SYMBOL:
+                if (exp.id == KW_TRUE || exp.id == KW_FALSE) {
+                    return makeInt(ConstType::BOOL, exp.id == KW_TRUE);
+                }
+                return lookup(exp.slot, frame);
+
+            case ExpType::LIST:
+                break;
+        }
+
+        const auto& tag = exp.list[0];
+
+        if (tag.type != ExpType::SYMBOL) {
+            return unsupported();
+        }
+
+        switch (tag.id) {
+            case KW_ADD: case KW_SUB: case KW_MUL: case KW_DIV:
+            case KW_GT: case KW_LT: case KW_EQ: case KW_NE: case KW_GE: case KW_LE:
+                return evalBinary(exp, frame);
+
+            // the branches are promoted to their common type
+            case KW_IF: {
+                auto thenType = typeOf(exp.list[2], frame);
+                auto elseType = typeOf(exp.list[3], frame);
+                auto condition = eval(exp.list[1], frame);
+
+                if (!thenType || !elseType || !condition || condition->type != ConstType::BOOL) {
+                    return condition ? unsupported() : std::nullopt;
+                }
+
+                auto result = eval(exp.list[condition->integer ? 2 : 3], frame);
+                if (!result) {
+                    return std::nullopt;
+                }
+                return cast(*result, commonType(*thenType, *elseType));
+            }
+
+            case KW_WHILE:
+                for (;;) {
+                    auto condition = eval(exp.list[1], frame);
+                    if (!condition || condition->type != ConstType::BOOL) {
+                        return condition ? unsupported() : std::nullopt;
+                    }
+                    if (!condition->integer) {
+                        return makeInt(ConstType::I32, 0);
+                    }
+                    if (!eval(exp.list[2], frame)) {
+                        return std::nullopt;
+                    }
+                }
+
+            case KW_BEGIN: {
+                std::optional<ConstValue> result;
+                for (auto i = 1; i < exp.list.size(); i++) {
+                    result = eval(exp.list[i], frame);
+                    if (!result) {
+                        return std::nullopt;
+                    }
+                }
+                return result;
+            }
+
+            // (var <name> <init>): the value of a var is not used
+            case KW_VAR: {
+                auto init = eval(exp.list[2], frame);
+                if (!init) {
+                    return std::nullopt;
+                }
+
+                const auto& decl = exp.list[1];
+                if (decl.type == ExpType::LIST) {
+                    auto declType = getType(decl.list[1]);
+                    if (!declType) {
+                        return unsupported();
+                    }
+                    init = cast(*init, *declType);
+                    frame.emplace_back(decl.list[0].slot, *init);
+                } else {
+                    frame.emplace_back(decl.slot, *init);
+                }
+
+                return makeInt(ConstType::I32, 0);
+            }
+
+            // (set <name> <value>): converted to the type of the local
+            case KW_SET: {
+                auto local = exp.list[1].type == ExpType::SYMBOL ? findLocal(exp.list[1].slot, frame) : nullptr;
+                if (local == nullptr) {
+                    return unsupported();
+                }
+
+                auto value = eval(exp.list[2], frame);
+                if (!value) {
+                    return std::nullopt;
+                }
+
+                return *local = cast(*value, local->type);
+            }
+
+            default:
+                if (tag.id < KEYWORDS_COUNT) {
+                    return unsupported();
+                }
+                return evalCall(exp, frame);
+        }
+    }
+
+    // (<op> <a> <b>): the operands are promoted to their common type
+    std::optional<ConstValue> evalBinary(const Exp& exp, Frame& frame) {
+        auto a = eval(exp.list[1], frame);
+        if (!a) {
+            return std::nullopt;
+        }
+        auto b = eval(exp.list[2], frame);
+        if (!b) {
+            return std::nullopt;
+        }
+
+        auto type = commonType(a->type, b->type);
+
+        if (type == ConstType::BOOL) {
+            return unsupported();
+        }
+
+        auto x = cast(*a, type);
+        auto y = cast(*b, type);
+        auto op = exp.list[0].id;
+
+        if (type == ConstType::F64) {
+            switch (op) {
+                case KW_ADD: return makeFloat(x.decimal + y.decimal);
+                case KW_SUB: return makeFloat(x.decimal - y.decimal);
+                case KW_MUL: return makeFloat(x.decimal * y.decimal);
+                case KW_DIV: return makeFloat(x.decimal / y.decimal);
+                case KW_GT: return makeInt(ConstType::BOOL, x.decimal > y.decimal);
+                case KW_LT: return makeInt(ConstType::BOOL, x.decimal < y.decimal);
+                case KW_EQ: return makeInt(ConstType::BOOL, x.decimal == y.decimal);
+                case KW_NE: return makeInt(ConstType::BOOL, x.decimal != y.decimal);
+                case KW_GE: return makeInt(ConstType::BOOL, x.decimal >= y.decimal);
+                default: return makeInt(ConstType::BOOL, x.decimal <= y.decimal);
+            }
+        }
+
+        // two's complement, in 64 bits then wrapped
+        auto i = (uint64_t)x.integer;
+        auto j = (uint64_t)y.integer;
+
+        switch (op) {
+            case KW_ADD: return makeInt(type, i + j);
+            case KW_SUB: return makeInt(type, i - j);
+            case KW_MUL: return makeInt(type, i * j);
+            case KW_DIV:
+                // undefined in the compiled code
+                if (y.integer == 0 || (y.integer == -1 && x.integer == minInt(type))) {
+                    return std::nullopt;
+                }
+                return makeInt(type, x.integer / y.integer);
+            case KW_GT: return makeInt(ConstType::BOOL, x.integer > y.integer);
+            case KW_LT: return makeInt(ConstType::BOOL, x.integer < y.integer);
+            case KW_EQ: return makeInt(ConstType::BOOL, x.integer == y.integer);
+            case KW_NE: return makeInt(ConstType::BOOL, x.integer != y.integer);
+            case KW_GE: return makeInt(ConstType::BOOL, x.integer >= y.integer);
+            default: return makeInt(ConstType::BOOL, x.integer <= y.integer);
+        }
+    }
+
+    // (<function> <args>...)
+    std::optional<ConstValue> evalCall(const Exp& exp, Frame& frame) {
+        auto it = functions_.find(exp.list[0].slot);
+        if (it == functions_.end()) {
+            return unsupported();
+        }
+
+        std::vector<ConstValue> args;
+
+        for (auto i = 1; i < exp.list.size(); i++) {
+            auto arg = eval(exp.list[i], frame);
+            if (!arg) {
+                return std::nullopt;
+            }
+            args.push_back(*arg);
+        }
+
+        return call(*it->second, args);
+    }
+
+    // the args are converted to the param types (checked by
+    // isPureFunction), the result to the return type
+    std::optional<ConstValue> call(const Exp& fnExp, const std::vector<ConstValue>& args) {
+        const auto& params = fnExp.list[2];
+
+        if (params.list.size() != args.size() || depth_ == MAX_DEPTH) {
+            return std::nullopt;
+        }
+
+        Frame callFrame;
+
+        for (auto i = 0; i < params.list.size(); i++) {
+            const auto& param = params.list[i];
+
+            if (param.type == ExpType::LIST) {
+                callFrame.emplace_back(param.list[0].slot, cast(args[i], *getType(param.list[1])));
+            } else {
+                callFrame.emplace_back(param.slot, cast(args[i], ConstType::I32));
+            }
+        }
+
+        auto returnType = getReturnType(fnExp);
+
+        depth_++;
+        unsupported_ = false;
+        auto result = eval(fnExp.list[fnExp.list.size() - 1], callFrame);
+        depth_--;
+
+        if (!result) {
+            // the body is outside of the subset (for any args)
+            return unsupported_ ? markImpure(fnExp) : std::nullopt;
+        }
+
+        return cast(*result, *returnType);
+    }
+
+    // the return type, i32 if it's not declared
+    std::optional<ConstType> getReturnType(const Exp& fnExp) {
+        bool hasReturnType = fnExp.list[3].type == ExpType::SYMBOL && fnExp.list[3].id == KW_ARROW;
+        return hasReturnType ? getType(fnExp.list[4]) : ConstType::I32;
+    }
+
+    // whether the types of a function and the forms of its body are
+    // in the subset: it can be evaluated (for some args)
+    bool isPureFunction(const Exp& fnExp) {
+        if (!getReturnType(fnExp)) {
+            return false;
+        }
+
+        // the params and the locals, by slot
+        std::unordered_set<uint32_t> locals;
+
+        for (const auto& param : fnExp.list[2].list) {
+            if (param.type == ExpType::LIST && !getType(param.list[1])) {
+                return false;
+            }
+            locals.insert(param.type == ExpType::LIST ? param.list[0].slot : param.slot);
+        }
+
+        return isPure(fnExp.list[fnExp.list.size() - 1], fnExp.list[1].slot, locals);
+    }
+
+    bool isPure(const Exp& exp, uint32_t fnSlot, std::unordered_set<uint32_t>& locals) {
+        switch (exp.type) {
+            case ExpType::NUMBER:
+            case ExpType::FLOAT:
+                return true;
+
+            case ExpType::STRING:
+                return false;
+
+            case ExpType::SYMBOL:
+                return exp.id == KW_TRUE || exp.id == KW_FALSE || locals.count(exp.slot) ||
+                       constants_.count(exp.slot);
+
+            case ExpType::LIST:
+                break;
+        }
+
+        const auto& tag = exp.list[0];
+
+        if (tag.type != ExpType::SYMBOL) {
+            return false;
+        }
+
+        auto items = [&](size_t from) {
+            for (auto i = from; i < exp.list.size(); i++) {
+                if (!isPure(exp.list[i], fnSlot, locals)) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        switch (tag.id) {
+            case KW_ADD: case KW_SUB: case KW_MUL: case KW_DIV:
+            case KW_GT: case KW_LT: case KW_EQ: case KW_NE: case KW_GE: case KW_LE:
+            case KW_IF: case KW_WHILE: case KW_BEGIN:
+                return items(1);
+
+            case KW_VAR: {
+                const auto& decl = exp.list[1];
+                if (!items(2) || (decl.type == ExpType::LIST && !getType(decl.list[1]))) {
+                    return false;
+                }
+                locals.insert(decl.type == ExpType::LIST ? decl.list[0].slot : decl.slot);
+                return true;
+            }
+
+            case KW_SET:
+                return exp.list[1].type == ExpType::SYMBOL && locals.count(exp.list[1].slot) && items(2);
+
+            // calls of itself and of the functions of the subset
+            default:
+                return tag.id >= KEYWORDS_COUNT && (tag.slot == fnSlot || functions_.count(tag.slot)) && items(1);
+        }
+    }
+
+    // static type of an expression, as given by the code generator
+    // (the locals declared in it are only visible to the rest of it)
+    std::optional<ConstType> typeOf(const Exp& exp, Frame& frame) {
+        auto size = frame.size();
+        auto type = typeOfExp(exp, frame);
+        frame.resize(size, {0, makeInt(ConstType::I32, 0)});
+        return type;
+    }
+
+    std::optional<ConstType> typeOfExp(const Exp& exp, Frame& frame) {
+        switch (exp.type) {
+            case ExpType::NUMBER:
+                return exp.number != (int32_t)exp.number ? ConstType::I64 : ConstType::I32;
+
+            case ExpType::FLOAT:
+                return ConstType::F64;
+
+            case ExpType::STRING:
+                return std::nullopt;
+
+            case ExpType::SYMBOL: {
+                if (exp.id == KW_TRUE || exp.id == KW_FALSE) {
+                    return ConstType::BOOL;
+                }
+                auto value = lookup(exp.slot, frame);
+                return value ? std::optional<ConstType>(value->type) : std::nullopt;
+            }
+
+            case ExpType::LIST:
+                break;
+        }
+
+        const auto& tag = exp.list[0];
+
+        if (tag.type != ExpType::SYMBOL) {
+            return std::nullopt;
+        }
+
+        switch (tag.id) {
+            case KW_ADD: case KW_SUB: case KW_MUL: case KW_DIV: {
+                auto a = typeOfExp(exp.list[1], frame);
+                auto b = typeOfExp(exp.list[2], frame);
+                return a && b ? std::optional<ConstType>(commonType(*a, *b)) : std::nullopt;
+            }
+
+            case KW_GT: case KW_LT: case KW_EQ: case KW_NE: case KW_GE: case KW_LE:
+                return ConstType::BOOL;
+
+            case KW_IF: {
+                auto a = typeOfExp(exp.list[2], frame);
+                auto b = typeOfExp(exp.list[3], frame);
+                return a && b ? std::optional<ConstType>(commonType(*a, *b)) : std::nullopt;
+            }
+
+            case KW_WHILE:
+                return ConstType::I32;
+
+            case KW_BEGIN: {
+                std::optional<ConstType> type;
+                for (auto i = 1; i < exp.list.size(); i++) {
+                    type = typeOfExp(exp.list[i], frame);
+                }
+                return type;
+            }
+
+            // declares the local for the next expressions, a placeholder value
+            case KW_VAR: {
+                const auto& decl = exp.list[1];
+                auto type = decl.type == ExpType::LIST ? getType(decl.list[1]) : typeOfExp(exp.list[2], frame);
+                if (type) {
+                    frame.emplace_back(decl.type == ExpType::LIST ? decl.list[0].slot : decl.slot,
+                                       *type == ConstType::F64 ? makeFloat(0) : makeInt(*type, 0));
+                }
+                return std::nullopt;
+            }
+
+            case KW_SET: {
+                auto local = findLocal(exp.list[1].slot, frame);
+                return local ? std::optional<ConstType>(local->type) : std::nullopt;
+            }
+
+            default: {
+                auto it = functions_.find(tag.slot);
+                if (it == functions_.end()) {
+                    return std::nullopt;
+                }
+                return getReturnType(*it->second);
+            }
+        }
+    }
+
+    // a local of the call, or a constant
+    std::optional<ConstValue> lookup(uint32_t slot, Frame& frame) {
+        if (auto local = findLocal(slot, frame)) {
+            return *local;
+        }
+
+        auto it = constants_.find(slot);
+        if (it == constants_.end()) {
+            return unsupported();
+        }
+
+        return it->second;
+    }
+
+    ConstValue* findLocal(uint32_t slot, Frame& frame) {
+        for (auto it = frame.rbegin(); it != frame.rend(); it++) {
+            if (it->first == slot) {
+                return &it->second;
+            }
+        }
+        return nullptr;
+    }
+
+    // the type named by a type expression, if it's in the subset
+    std::optional<ConstType> getType(const Exp& type) {
+        if (type.type != ExpType::SYMBOL) {
+            return std::nullopt;
+        }
+
+        switch (type.id) {
+            case KW_NUMBER: case KW_I32: return ConstType::I32;
+            case KW_I64: return ConstType::I64;
+            case KW_F64: return ConstType::F64;
+            default: return std::nullopt;
+        }
+    }
+
+    // f64 if either is f64, otherwise the widest integer
+    ConstType commonType(ConstType a, ConstType b) {
+        return a == ConstType::F64 || b == ConstType::F64 ? ConstType::F64 : std::max(a, b);
+    }
+
+    // integers are sign extended or truncated (booleans are
+    // zero extended), and converted to and from f64 as signed
+    ConstValue cast(ConstValue value, ConstType type) {
+        if (value.type == type) {
+            return value;
+        }
+
+        if (type == ConstType::F64) {
+            return makeFloat((double)value.integer);
+        }
+
+        if (value.type == ConstType::F64) {
+            // out of range: a poison value in the compiled code
+            auto decimal = std::trunc(value.decimal);
+            return decimal >= -9.2e18 && decimal <= 9.2e18 ? makeInt(type, (int64_t)decimal) : makeInt(type, 0);
+        }
+
+        return makeInt(type, value.integer);
+    }
+
+    // wrapped to the width of the type
+    ConstValue makeInt(ConstType type, uint64_t bits) {
+        ConstValue value{type, {}};
+
+        switch (type) {
+            case ConstType::BOOL: value.integer = bits & 1; break;
+            case ConstType::I32: value.integer = (int32_t)(uint32_t)bits; break;
+            default: value.integer = (int64_t)bits; break;
+        }
+
+        return value;
+    }
+
+    ConstValue makeFloat(double decimal) {
+        ConstValue value{ConstType::F64, {}};
+        value.decimal = decimal;
+        return value;
+    }
+
+    int64_t minInt(ConstType type) { return type == ConstType::I32 ? INT32_MIN : INT64_MIN; }
+
+    // a form outside of the subset
+    std::optional<ConstValue> unsupported() {
+        unsupported_ = true;
+        return std::nullopt;
+    }
+
+    // a function found outside of the subset is dropped
+    std::optional<ConstValue> markImpure(const Exp& fnExp) {
+        functions_.erase(fnExp.list[1].slot);
+        return std::nullopt;
+    }
+
+    // deep copy, the symbols keep their slots
+    Exp copyExp(const Exp& exp) {
+        Exp copy = exp;
+
+        if (exp.type == ExpType::LIST) {
+            std::vector<Exp> items;
+            items.reserve(exp.list.size());
+            for (const auto& item : exp.list) {
+                items.push_back(copyExp(item));
+            }
+            copy.list = arena_.makeList(items.data(), items.size());
+        } else if (exp.type == ExpType::STRING) {
+            copy = Exp::makeString(arena_.makeString(exp.string()));
+        }
+
+        return copy;
+    }
+
+    static constexpr size_t MAX_DEPTH = 1000;
+
+    // copies of the functions of the subset, by slot
+    std::unordered_map<uint32_t, const Exp*> functions_;
+
+    // calls which failed: the function slot, then the type
+    // and the bits of each arg
+    std::set<std::vector<int64_t>> failedCalls_;
+
+    // values of the constants, by slot
+    std::unordered_map<uint32_t, ConstValue> constants_;
+
+    // storage of the copies
+    ExpArena arena_;
+
+    // steps left in the current evaluation
+    uint64_t steps_ = 0;
+
+    // nested calls
+    size_t depth_ = 0;
+
+    // the last failure is a form outside of the subset
+    bool unsupported_ = false;
+};
+
+#endif
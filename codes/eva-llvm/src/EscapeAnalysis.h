@@ -0,0 +1,502 @@
+/*
+    EscapeAnalysis: finds the `new` instances which don't outlive the
+    function allocating them, run after name resolution.
+
+    An instance escapes when it is stored (into a variable, a field or
+    a global), returned, or passed to a callee which may keep it. The
+    callees are summarized per parameter: functions and the methods of
+    an instance of a known class are analyzed, unknown callees (virtual
+    calls, function values) keep their arguments. The instances which
+    don't escape can be allocated on the stack.
+
+    Lambdas are tracked as instances of their environment, which holds
+    the captured variables: these escape. A lambda bound to a variable
+    which is only called is lifted, it needs no environment.
+
+    The top-level forms are analyzed one at a time (in streaming mode
+    the next ones are not parsed yet), so the variables they define,
+    which the next forms can use, escape.
+*/
+#ifndef EscapeAnalysis_h
+#define EscapeAnalysis_h
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+
+#include "./parser/Exp.h"
+#include "./Resolver.h"
+
+class EscapeAnalysis {
+public:
+    // the captures of the lambdas come from the resolver
+    explicit EscapeAnalysis(const Resolver& resolver) : resolver_(resolver) {}
+
+    // analyzes a resolved top-level form, the previous results are
+    // dropped (in streaming mode the nodes of each form are reused)
+    void analyze(const Exp& form) {
+        news_.clear();
+        stackNews_.clear();
+        liftedLambdas_.clear();
+
+        // a variable of main, used by the next forms
+        if (isTaggedList(form, KW_VAR)) {
+            markEscaping(varSlot(form.list[1]));
+        }
+
+        // recursive functions: the summaries only grow, until they are stable
+        do {
+            changed_ = false;
+            news_.clear();
+            visit(form, /* escapes */ false);
+        } while (changed_);
+
+        for (auto& [newExp, varSlot] : news_) {
+            if (!escapingNews_.count(newExp) && (varSlot == NO_SLOT || !isEscaping(varSlot))) {
+                stackNews_.insert(newExp);
+            }
+
+            if (varSlot != NO_SLOT && isTaggedList(*newExp, KW_LAMBDA) && !isValue(varSlot)) {
+                liftedLambdas_.insert(newExp);
+            }
+        }
+
+        escapingNews_.clear();
+    }
+
+    // whether an instance of (new <class> <args>...) may outlive its function
+    // (or the environment of a (lambda ...))
+    bool escapes(const Exp& newExp) const { return !stackNews_.count(&newExp); }
+
+    // whether a lambda is bound to a variable which is only called
+    bool lifted(const Exp& lambdaExp) const { return liftedLambdas_.count(&lambdaExp); }
+
+private:
+    struct ClassSummary {
+        SymbolId parent;
+        // method name -> slot of its definition
+        llvm::DenseMap<SymbolId, uint32_t> methods;
+    };
+
+    void visit(const Exp& exp, bool escapes) {
+        switch (exp.type) {
+            case ExpType::SYMBOL:
+                if (exp.id == KW_TRUE || exp.id == KW_FALSE) {
+                    return;
+                }
+                markValue(exp.slot);
+                if (escapes) {
+                    markEscaping(exp.slot);
+                }
+                return;
+
+            case ExpType::NUMBER:
+            case ExpType::FLOAT:
+            case ExpType::STRING:
+                return;
+
+            case ExpType::LIST:
+                break;
+        }
+
+        const auto& tag = exp.list[0];
+
+        // method calls
+        if (tag.type == ExpType::LIST) {
+            visitMethodCall(exp);
+            return;
+        }
+
+        if (tag.id >= KEYWORDS_COUNT) {
+            visitCall(exp);
+            return;
+        }
+
+        switch (tag.id) {
+            // (begin <exp>...): the value is the last one
+            case KW_BEGIN:
+                for (auto i = 1; i < exp.list.size(); i++) {
+                    visit(exp.list[i], i == exp.list.size() - 1 && escapes);
+                }
+                return;
+
+            // (var <name> <init>): the variable is an alias of the init,
+            // except for instances bound directly (tracked by the slot)
+            case KW_VAR:
+                if (inClass_) {
+                    return;
+                }
+                if (isTaggedList(exp.list[2], KW_NEW)) {
+                    visitNew(exp.list[2], varSlot(exp.list[1]));
+                } else if (isTaggedList(exp.list[2], KW_LAMBDA)) {
+                    visitLambda(exp.list[2], varSlot(exp.list[1]));
+                    // a typed variable holds a closure
+                    if (exp.list[1].type == ExpType::LIST) {
+                        markValue(varSlot(exp.list[1]));
+                    }
+                } else {
+                    visit(exp.list[2], true);
+                }
+                return;
+
+            // (const <name> <exp>): computed by the compiler
+            case KW_CONST:
+                return;
+
+            // (set <name> <value>) or (set (prop <instance> <field>) <value>)
+            case KW_SET:
+                if (isTaggedList(exp.list[1], KW_PROP)) {
+                    visit(exp.list[1].list[1], false);
+                } else {
+                    visit(exp.list[1], true);
+                }
+                visit(exp.list[2], true);
+                return;
+
+            // (def <name> <params> [-> <type>] <body>): the body is returned
+            case KW_DEF:
+                visitFunction(exp);
+                return;
+
+            // (lambda <params> [-> <type>] <body>)
+            case KW_LAMBDA:
+                visitLambda(exp, NO_SLOT);
+                if (escapes) {
+                    escapingNews_.insert(&exp);
+                }
+                return;
+
+            // (class <name> <super> <body>)
+            case KW_CLASS:
+                visitClass(exp);
+                return;
+
+            // (new <class> <args>...)
+            case KW_NEW:
+                visitNew(exp, NO_SLOT);
+                if (escapes) {
+                    escapingNews_.insert(&exp);
+                }
+                return;
+
+            // (prop <instance> <name>), (method <instance> <name>)
+            case KW_PROP:
+            case KW_METHOD:
+                if (!isTaggedList(exp.list[1], KW_SUPER)) {
+                    visit(exp.list[1], false);
+                }
+                return;
+
+            // (if <condition> <then> <else>)
+            case KW_IF:
+                visit(exp.list[1], false);
+                visit(exp.list[2], escapes);
+                visit(exp.list[3], escapes);
+                return;
+
+            // (for (<name> <start> <end> [<step>]) <body> <options>...)
+            case KW_FOR:
+                if (exp.list.size() < 3 || exp.list[1].type != ExpType::LIST) {
+                    return;
+                }
+                for (auto i = 1; i < exp.list[1].list.size(); i++) {
+                    visit(exp.list[1].list[i], false);
+                }
+                visit(exp.list[2], false);
+                return;
+
+            case KW_BREAK:
+            case KW_CONTINUE:
+                return;
+
+            // (aset <array> <index> <value>): the value is stored
+            case KW_ASET:
+                visit(exp.list[1], false);
+                visit(exp.list[2], false);
+                visit(exp.list[3], true);
+                return;
+
+            // (new-array <type> <length>)
+            case KW_NEW_ARRAY:
+                visit(exp.list[2], false);
+                return;
+
+            // operators, while, printf and array reads don't keep their operands
+            case KW_ADD: case KW_SUB: case KW_MUL: case KW_DIV:
+            case KW_GT: case KW_LT: case KW_EQ: case KW_NE: case KW_GE: case KW_LE:
+            case KW_WHILE: case KW_PRINTF: case KW_AREF: case KW_LEN:
+                for (auto i = 1; i < exp.list.size(); i++) {
+                    visit(exp.list[i], false);
+                }
+                return;
+
+            // other keywords in call position are called as functions
+            default:
+                visitCall(exp);
+                return;
+        }
+    }
+
+    // (<name> <args>...): a function or a functor (callable instance)
+    void visitCall(const Exp& exp) {
+        const auto& callee = exp.list[0];
+
+        auto newIt = varClasses_.find(callee.slot);
+        if (newIt != varClasses_.end()) {
+            // self is the first param of __call__
+            visitArgs(exp, 0, lookupMethod(newIt->second, KW_CALL), 0);
+            return;
+        }
+
+        // the callee is only called, not used as a value
+        visitArgs(exp, 1, lookupFunction(callee.slot), 0);
+    }
+
+    // ((method <instance> <name>) <args>...)
+    void visitMethodCall(const Exp& exp) {
+        const auto& method = exp.list[0];
+
+        if (!isTaggedList(method, KW_METHOD)) {
+            visit(method, false);
+            visitArgs(exp, 1, nullptr, 0);
+            return;
+        }
+
+        const auto& instance = method.list[1];
+        auto methodName = method.list[2].id;
+
+        // (method (super <class>) <name>): the parent's method, self is passed explicitly
+        if (isTaggedList(instance, KW_SUPER)) {
+            auto it = classes_.find(instance.list[1].id);
+            auto summary = it == classes_.end() ? nullptr : lookupMethod(it->second.parent, methodName);
+            visitArgs(exp, 1, summary, 0);
+            return;
+        }
+
+        // an instance of a known class: the method is known
+        auto classId = NO_CLASS;
+        if (instance.type == ExpType::SYMBOL) {
+            auto it = varClasses_.find(instance.slot);
+            if (it != varClasses_.end()) {
+                classId = it->second;
+            }
+        } else if (isTaggedList(instance, KW_NEW)) {
+            visitNew(instance, NO_SLOT);
+            classId = instance.list[1].id;
+        }
+
+        // the instance is only read for its vTable, self is passed explicitly
+        if (!isTaggedList(instance, KW_NEW)) {
+            visit(instance, false);
+        }
+
+        auto summary = classId == NO_CLASS ? nullptr : lookupMethod(classId, methodName);
+        visitArgs(exp, 1, summary, 0);
+    }
+
+    // (new <class> <args>...): the args are passed to the constructor
+    // after self, `varSlot` is the variable the instance is bound to
+    void visitNew(const Exp& exp, uint32_t varSlot) {
+        auto classId = exp.list[1].id;
+        auto ctor = lookupMethod(classId, KW_CONSTRUCTOR);
+
+        news_.emplace_back(&exp, varSlot);
+
+        if (varSlot != NO_SLOT) {
+            varClasses_[varSlot] = classId;
+        }
+
+        if (ctor == nullptr || paramEscapes(ctor, 0)) {
+            if (varSlot != NO_SLOT) {
+                markEscaping(varSlot);
+            } else {
+                escapingNews_.insert(&exp);
+            }
+        }
+
+        visitArgs(exp, 2, ctor, 1);
+    }
+
+    // args from `from` are passed to the params from `param`,
+    // all of them escape to an unknown callee
+    void visitArgs(const Exp& exp, size_t from, const std::vector<bool>* summary, size_t param) {
+        for (auto i = from; i < exp.list.size(); i++, param++) {
+            visit(exp.list[i], summary == nullptr || paramEscapes(summary, param));
+        }
+    }
+
+    // a param escapes if its value escapes in the body
+    void visitFunction(const Exp& fnExp) {
+        auto fnSlot = fnExp.list[1].slot;
+        const auto& params = fnExp.list[2];
+
+        auto& summary = summaries_[fnSlot];
+        summary.resize(params.list.size(), false);
+
+        for (auto i = 0; i < params.list.size(); i++) {
+            params_[varSlot(params.list[i])] = {fnSlot, i};
+        }
+
+        bool hasReturnType = fnExp.list[3].type == ExpType::SYMBOL && fnExp.list[3].id == KW_ARROW;
+
+        auto prevInClass = inClass_;
+        inClass_ = false;
+        visit(hasReturnType ? fnExp.list[5] : fnExp.list[3], true);
+        inClass_ = prevInClass;
+    }
+
+    // a lambda is called through its closure (an unknown callee, which
+    // keeps its args), `varSlot` is the variable it is bound to
+    void visitLambda(const Exp& lambdaExp, uint32_t varSlot) {
+        news_.emplace_back(&lambdaExp, varSlot);
+
+        // the captured values are copied into the environment
+        for (auto slot : resolver_.captures(lambdaExp)) {
+            markValue(slot);
+            markEscaping(slot);
+        }
+
+        bool hasReturnType = lambdaExp.list[2].type == ExpType::SYMBOL && lambdaExp.list[2].id == KW_ARROW;
+
+        auto prevInClass = inClass_;
+        inClass_ = false;
+        visit(hasReturnType ? lambdaExp.list[4] : lambdaExp.list[2], true);
+        inClass_ = prevInClass;
+    }
+
+    // methods are summarized as functions, looked up by class
+    void visitClass(const Exp& clsExp) {
+        auto& cls = classes_[clsExp.list[1].id];
+        cls.parent = clsExp.list[2].id == KW_NULL_ ? NO_CLASS : clsExp.list[2].id;
+
+        const auto& body = clsExp.list[3];
+
+        for (auto i = 1; i < body.list.size(); i++) {
+            const auto& exp = body.list[i];
+            if (isTaggedList(exp, KW_DEF)) {
+                // methods may call each other before they are visited
+                cls.methods[exp.list[1].id] = exp.list[1].slot;
+                summaries_[exp.list[1].slot].resize(exp.list[2].list.size(), false);
+            }
+        }
+
+        auto prevInClass = inClass_;
+        inClass_ = true;
+        visit(body, false);
+        inClass_ = prevInClass;
+    }
+
+    const std::vector<bool>* lookupFunction(uint32_t slot) {
+        auto it = summaries_.find(slot);
+        return it == summaries_.end() ? nullptr : &it->second;
+    }
+
+    // the method of a class or of its closest ancestor
+    const std::vector<bool>* lookupMethod(SymbolId classId, SymbolId methodName) {
+        while (classId != NO_CLASS) {
+            auto it = classes_.find(classId);
+            if (it == classes_.end()) {
+                return nullptr;
+            }
+
+            auto method = it->second.methods.find(methodName);
+            if (method != it->second.methods.end()) {
+                return lookupFunction(method->second);
+            }
+
+            classId = it->second.parent;
+        }
+
+        return nullptr;
+    }
+
+    bool paramEscapes(const std::vector<bool>* summary, size_t param) {
+        return param >= summary->size() || (*summary)[param];
+    }
+
+    bool isEscaping(uint32_t slot) { return slot < escaping_.size() && escaping_[slot]; }
+
+    bool isValue(uint32_t slot) { return slot < values_.size() && values_[slot]; }
+
+    // marks a binding as used as a value, not only called
+    void markValue(uint32_t slot) {
+        if (slot >= values_.size()) {
+            values_.resize(slot + 1, false);
+        }
+        values_[slot] = true;
+    }
+
+    // marks a binding as escaping, and the param it may be
+    void markEscaping(uint32_t slot) {
+        if (isEscaping(slot)) {
+            return;
+        }
+
+        if (slot >= escaping_.size()) {
+            escaping_.resize(slot + 1, false);
+        }
+        escaping_[slot] = true;
+
+        auto it = params_.find(slot);
+        if (it != params_.end()) {
+            summaries_[it->second.first][it->second.second] = true;
+            changed_ = true;
+        }
+    }
+
+    uint32_t varSlot(const Exp& decl) {
+        return decl.type == ExpType::LIST ? decl.list[0].slot : decl.slot;
+    }
+
+    bool isTaggedList(const Exp& exp, SymbolId tag) {
+        return exp.type == ExpType::LIST && exp.list[0].type == ExpType::SYMBOL &&
+               exp.list[0].id == tag;
+    }
+
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+    static constexpr SymbolId NO_CLASS = UINT32_MAX;
+
+    const Resolver& resolver_;
+
+    // escaping bindings, by slot
+    std::vector<bool> escaping_;
+
+    // bindings used as values, by slot
+    std::vector<bool> values_;
+
+    // escaping params per function (or method) slot
+    std::unordered_map<uint32_t, std::vector<bool>> summaries_;
+
+    // param slot -> (function slot, param index)
+    std::unordered_map<uint32_t, std::pair<uint32_t, size_t>> params_;
+
+    // class of the instance bound to a variable slot
+    std::unordered_map<uint32_t, SymbolId> varClasses_;
+
+    // classes by name
+    std::unordered_map<SymbolId, ClassSummary> classes_;
+
+    // (new ...) nodes of the form, with the variable they are bound to
+    std::vector<std::pair<const Exp*, uint32_t>> news_;
+
+    // escaping (new ...) nodes which are not bound to a variable
+    llvm::DenseSet<const Exp*> escapingNews_;
+
+    // results: the (new ...) nodes which can be allocated on the stack
+    llvm::DenseSet<const Exp*> stackNews_;
+
+    // and the lambdas which are lifted
+    llvm::DenseSet<const Exp*> liftedLambdas_;
+
+    // a summary grew in the last iteration
+    bool changed_ = false;
+
+    // visiting a class body
+    bool inClass_ = false;
+};
+
+#endif
@@ -0,0 +1,198 @@
+/*
+    EvaJIT: runs a compiled module in-process with ORC LLJIT.
+*/
+#ifndef EvaJIT_h
+#define EvaJIT_h
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/TargetSelect.h"
+
+#include "./runtime/EvaRuntime.h"
+#include "./Logger.h"
+
+class EvaJIT {
+public:
+    EvaJIT() {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+
+        auto jit = llvm::orc::LLJITBuilder().create();
+        if (!jit) {
+            DIE << "[EvaJIT]: " << llvm::toString(jit.takeError()) << std::endl;
+        }
+        jit_ = std::move(*jit);
+
+        setupHostSymbols();
+    }
+
+    const llvm::Triple& getTargetTriple() const { return jit_->getTargetTriple(); }
+
+    const llvm::DataLayout& getDataLayout() const { return jit_->getDataLayout(); }
+
+    // compiles the module and runs its main, returns the exit code
+    int run(std::unique_ptr<llvm::Module> module, std::unique_ptr<llvm::LLVMContext> ctx) {
+        module->setTargetTriple(getTargetTriple().str());
+        module->setDataLayout(getDataLayout());
+
+        // main runs on this thread only: thread-local
+        // globals (the class nurseries) are plain ones
+        for (auto& global : module->globals()) {
+            global.setThreadLocal(false);
+        }
+
+        check(jit_->addIRModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(ctx))));
+
+        // the module is compiled when main is first looked up
+        auto compileStart = std::chrono::steady_clock::now();
+
+        auto mainSymbol = jit_->lookup("main");
+        if (!mainSymbol) {
+            DIE << "[EvaJIT]: " << llvm::toString(mainSymbol.takeError()) << std::endl;
+        }
+        auto main = (int (*)())mainSymbol->getAddress();
+
+        auto runStart = std::chrono::steady_clock::now();
+
+        auto exitCode = main();
+        std::fflush(stdout);
+
+        auto runEnd = std::chrono::steady_clock::now();
+
+        compileTime = std::chrono::duration<double, std::milli>(runStart - compileStart).count();
+        runTime = std::chrono::duration<double, std::milli>(runEnd - runStart).count();
+
+        return exitCode;
+    }
+
+    // time spent compiling the module to machine code, in ms
+    double compileTime = 0;
+
+    // time spent running main, in ms
+    double runTime = 0;
+
+private:
+    // printf, GC_malloc and the rest of the runtime come from the host process
+    void setupHostSymbols() {
+        auto& mainLib = jit_->getMainJITDylib();
+        auto prefix = jit_->getDataLayout().getGlobalPrefix();
+
+        // symbols of the process itself
+        llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+
+        // the garbage collector may only be available as a shared library
+        if (llvm::sys::DynamicLibrary::SearchForAddressOfSymbol("GC_malloc") == nullptr) {
+            for (auto gcLib : {"libgc.so.1", "libgc.so", "libgc.1.dylib", "libgc.dylib"}) {
+                if (!llvm::sys::DynamicLibrary::LoadLibraryPermanently(gcLib)) {
+                    break;
+                }
+            }
+        }
+
+        auto& session = jit_->getExecutionSession();
+
+        auto gcSymbol = [](const char* name) {
+            return llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(name);
+        };
+
+        if (gcSymbol("GC_malloc") != nullptr) {
+            gc_ = {
+                (void* (*)(size_t))gcSymbol("GC_malloc"),
+                (void* (*)(size_t))gcSymbol("GC_malloc_atomic"),
+                (uint64_t (*)(const uint64_t*, size_t))gcSymbol("GC_make_descriptor"),
+                (void* (*)(size_t, uint64_t))gcSymbol("GC_malloc_explicitly_typed"),
+                (void (*)(size_t, int, void**))gcSymbol("GC_generic_malloc_many"),
+                (size_t (*)(const void*))gcSymbol("GC_size"),
+                (void (*)(void*, void*))gcSymbol("GC_add_roots"),
+                (void** (*)())gcSymbol("GC_new_free_list"),
+                (unsigned (*)(void**, uint64_t, int, int))gcSymbol("GC_new_kind"),
+            };
+        }
+
+        // without libgc the objects are never freed
+        else {
+            std::cerr << "[EvaJIT]: libgc not found, GC_malloc falls back to malloc." << std::endl;
+
+            // GC_malloc zeroes, GC_malloc_atomic doesn't
+            gc_ = {
+                [](size_t size) { return std::calloc(1, size); },
+                &std::malloc,
+                [](const uint64_t*, size_t) -> uint64_t { return 0; },
+                [](size_t size, uint64_t) { return std::calloc(1, size); },
+                &mallocMany,
+                [](const void*) -> size_t { return 0; },
+                [](void*, void*) {},
+                []() -> void** { return nullptr; },
+                // any kind but the pointer-free one, mallocMany zeroes all
+                [](void**, uint64_t, int, int) -> unsigned { return 1; },
+            };
+
+            check(mainLib.define(llvm::orc::absoluteSymbols({
+                {session.intern(jit_->mangle("GC_malloc")),
+                 llvm::JITEvaluatedSymbol::fromPointer(gc_.malloc)},
+            })));
+        }
+
+        // the allocation runtime (runtime/EvaRuntime.h), in-process
+        check(mainLib.define(llvm::orc::absoluteSymbols({
+            {session.intern(jit_->mangle("eva_alloc_class_slow")),
+             llvm::JITEvaluatedSymbol::fromPointer(&allocClassSlow)},
+            {session.intern(jit_->mangle("eva_alloc_class")),
+             llvm::JITEvaluatedSymbol::fromPointer(&allocClass)},
+            {session.intern(jit_->mangle("eva_alloc_array")),
+             llvm::JITEvaluatedSymbol::fromPointer(&allocArray)},
+            {session.intern(jit_->mangle("eva_array_index_error")),
+             llvm::JITEvaluatedSymbol::fromPointer(&evaArrayIndexError)},
+        })));
+
+        auto generator = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(prefix);
+        if (!generator) {
+            DIE << "[EvaJIT]: " << llvm::toString(generator.takeError()) << std::endl;
+        }
+        mainLib.addGenerator(std::move(*generator));
+    }
+
+    void check(llvm::Error error) {
+        if (error) {
+            DIE << "[EvaJIT]: " << llvm::toString(std::move(error)) << std::endl;
+        }
+    }
+
+    // without libgc: a list of objects next to each other,
+    // carved out of one allocation
+    static void mallocMany(size_t size, int, void** list) {
+        auto count = 32 * 1024 / size + 1;
+        auto objects = (char*)std::calloc(count, size);
+
+        *list = nullptr;
+        for (auto i = count; objects != nullptr && i > 0; i--) {
+            auto object = objects + (i - 1) * size;
+            *(void**)object = *list;
+            *list = object;
+        }
+    }
+
+    static void* allocClassSlow(EvaNursery* nursery, EvaClassDescriptor* cls) {
+        return evaAllocClassSlow(gc_, nursery, cls);
+    }
+
+    static void* allocClass(EvaClassDescriptor* cls) { return evaAllocClass(gc_, cls); }
+
+    static void* allocArray(EvaClassDescriptor* cls, int64_t length) { return evaAllocArray(gc_, cls, length); }
+
+    // libgc, or malloc without it
+    static inline EvaGC gc_;
+
+    std::unique_ptr<llvm::orc::LLJIT> jit_;
+};
+
+#endif
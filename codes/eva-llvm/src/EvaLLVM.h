@@ -5,28 +5,104 @@
 #define EvaLLVM_h
 
 #include <string>
+#include <chrono>
 #include <iostream>
-#include <regex>
 #include <map>
-
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/Transforms/Scalar/RewriteStatepointsForGC.h"
+#include "llvm/Transforms/Utils/Mem2Reg.h"
 
 #include "./parser/EvaParser.h"
-#include "./Environment.h"
+#include "./Resolver.h"
+#include "./EscapeAnalysis.h"
+#include "./ConstEvaluator.h"
+#include "./EvaPasses.h"
+#include "./EvaJIT.h"
+#include "./runtime/EvaRuntime.h"
 #include "./Logger.h"
 
 using syntax::EvaParser;
 
-using Env = std::shared_ptr<Environment>;
+/*
+  Compiler options, set by the eva-llvm driver.
+*/
+struct CompilerOptions {
+  // compile top-level forms one by one as they are parsed
+  bool stream = false;
+
+  // optimization level: 0-3
+  unsigned optLevel = 0;
+
+  // target triple, the host when empty
+  std::string targetTriple;
+
+  // also emit a native object file
+  bool emitObject = false;
+
+  // reorder class fields to reduce padding and group hot fields
+  bool optimizeLayout = false;
+
+  // allow reassociation and other unsafe f64 optimizations
+  bool fastMath = false;
+
+  // allocate the instances which don't escape on the stack
+  bool stackAllocate = true;
+
+  // bump-allocate the instances from the class nurseries, inline
+  bool inlineAllocation = true;
+
+  // precise generational collector (runtime/EvaGC.h) instead of libgc:
+  // statepoints and stack maps, object files only
+  bool preciseGC = false;
+
+  // compile the self calls in tail position to jumps,
+  // at every optimization level
+  bool loopTailCalls = false;
+
+  // steps of the compile-time evaluation of a constant,
+  // the calls with constant args are folded in a fraction of it
+  uint64_t constEvalSteps = 1000000;
+
+  // field access counts for the layout, keyed by "<class>.<field>"
+  std::unordered_map<std::string, uint64_t> fieldProfile;
+};
 
 struct ClassInfo {
   llvm::StructType* cls; // the current class
   llvm::StructType* parent; // the parent class incase the base class inherits another class
-  std::map<std::string, llvm::Type*> fieldsMap; // the fields described in the current class
-  std::map<std::string, llvm::Function*> methodsMap; // the methods described in the current class
+  std::vector<std::pair<SymbolId, llvm::Type*>> fields; // fields in layout order, the parent's fields first
+  std::vector<std::pair<SymbolId, llvm::Function*>> methods; // methods in vTable order, the parent's methods first
+  llvm::DenseMap<SymbolId, unsigned> fieldSlots; // field name -> struct element index
+  llvm::DenseMap<SymbolId, unsigned> methodSlots; // method name -> vTable index
+};
+
+struct LambdaInfo {
+  llvm::Function* fn; // the lifted lambda: takes the captured values, then the params
+  std::vector<llvm::Value*> captures; // the values captured when the lambda was created
 };
 
 // index of the vTable in the class fields.
@@ -39,34 +115,67 @@ static const size_t VTABLE_INDEX = 0;
 */
 static const size_t RESERVED_FIELDS_COUNT = 1;
 
+/*
+  reserved entries at the beginning of each vTable, before
+  the methods: the class descriptor for the collector.
+*/
+static const size_t RESERVED_VTABLE_ENTRIES = 1;
+
+// array layout (runtime/EvaRuntime.h): vTable, length, elements
+static const size_t ARRAY_LENGTH_INDEX = 1;
+static const size_t ARRAY_ELEMENTS_INDEX = 2;
+
+// address space of the object pointers with the precise collector:
+// the statepoints rewriting only tracks this one
+static const unsigned GC_ADDRESS_SPACE = 1;
+
+// share of the constant evaluation steps for each call with
+// constant args: most of them are not worth trying longer
+static const uint64_t CONST_CALL_STEPS_RATIO = 100;
+
+// cache line size targeted by the field layout.
+static const uint64_t CACHE_LINE_SIZE = 64;
+
 // Binary operation macro
 // builder->Op exposes arithmetic, memory
-// and logical operations through the IR Builder
-#define GEN_BINARY_OP(Op, varName)            \
-  do {                                        \
-      auto op1 = gen(exp.list[1], env);       \
-      auto op2 = gen(exp.list[2], env);       \
-      return builder->Op(op1, op2, varName);  \
+// and logical operations through the IR Builder.
+// the operands are promoted to a common type, the
+// FloatOp is used for f64 and the IntOp for integers
+#define GEN_BINARY_OP(IntOp, FloatOp, varName)        \
+  do {                                                \
+      auto [op1, op2] = genOperands(exp);             \
+      if (op1->getType()->isDoubleTy()) {             \
+        return builder->FloatOp(op1, op2, varName);   \
+      }                                               \
+      return builder->IntOp(op1, op2, varName);       \
   } while(false)
 
 class EvaLLVM {
   public:
-    EvaLLVM() : parser(std::make_unique<EvaParser>()) { 
+    EvaLLVM(const CompilerOptions& options = {})
+        : options(options), parser(std::make_unique<EvaParser>()) { 
+      // the precise collector moves the objects: they all live in the heap
+      if (options.preciseGC) {
+        this->options.stackAllocate = false;
+      }
+
       moduleInit();
+      setupTargetMachine();
+      setupSpecialForms();
       setupExternFunction();
       setupGlobalEnvironment();
-      setupTargetTriple();
     }
 
     /*
-    Executes a program
+    Executes a program.
+    the source is not copied, it must outlive the call.
     */
-    void exec(const std::string& program) {
-      // 1. parsing the program
-      auto ast = parser->parse("(begin " + program + ")");
+    void exec(std::string_view program) {
+      // 1-2. parse and compile to LLVM IR
+      compileProgram(program);
 
-      // 2. compile to LLVM IR
-      compile(ast);
+      // optimize in-process
+      optimizeModule();
 
       // printing generated code.
       module->print(llvm::outs(), nullptr);
@@ -75,6 +184,80 @@ class EvaLLVM {
 
       // 3. save IR to file.
       saveModuleToFile("./bin/out.ll");
+
+      // 4. native code
+      if (options.emitObject) {
+        emitObjectFile("./bin/out.o");
+      }
+    }
+
+    /*
+      Compiles a program and runs it in-process with the JIT,
+      returns the exit code of main. Reports the time spent in
+      each phase on stderr.
+    */
+    int execJIT(std::string_view program) {
+      auto start = std::chrono::steady_clock::now();
+
+      if (options.preciseGC) {
+        DIE << "[EvaLLVM]: The precise collector needs the stack maps of an object file, use -c" << std::endl;
+      }
+
+      // 1-2. parse and compile to LLVM IR
+      compileProgram(program);
+
+      // optimize in-process
+      optimizeModule();
+
+      auto end = std::chrono::steady_clock::now();
+      auto frontendTime = std::chrono::duration<double, std::milli>(end - start).count();
+
+      // 3. compile to machine code and run
+      EvaJIT jit;
+
+      if (jit.getTargetTriple().str() != module->getTargetTriple()) {
+        DIE << "[EvaLLVM]: JIT can only run host code, the target is "
+            << module->getTargetTriple() << std::endl;
+      }
+      auto exitCode = jit.run(std::move(module), std::move(ctx));
+
+      std::cerr << "[eva-llvm] eva -> IR: " << frontendTime << " ms, "
+                << "JIT compile: " << jit.compileTime << " ms, "
+                << "run: " << jit.runTime << " ms" << std::endl;
+
+      return exitCode;
+    }
+
+    /*
+      The LLVM IR of the module.
+    */
+    std::string getModuleIR() {
+      std::string ir;
+      llvm::raw_string_ostream out(ir);
+      module->print(out, nullptr);
+      return out.str();
+    }
+
+    /*
+      Parses and compiles a program into the module.
+      the source is not copied, it must outlive the call.
+    */
+    void compileProgram(std::string_view program) {
+      // parse and compile form by form
+      if (options.stream) {
+        compileStream(program);
+      }
+
+      else {
+        // 1. parsing the program, top-level forms are wrapped into (begin ...)
+        auto ast = parser->parseProgram(program);
+
+        // 2. compile to LLVM IR
+        compile(ast);
+
+        // the AST is no longer needed, free it in one shot.
+        parser->reset();
+      }
     }
 
   private:
@@ -82,50 +265,125 @@ class EvaLLVM {
       compiles an expression
     */
     void compile(const Exp& ast) {
-      // 1. make main function
+      // 1. resolve variable references to binding slots
+      resolver.resolve(ast);
+      bindings_.resize(resolver.slotsCount());
+
+      // 2. make main function
+      compileMainBegin();
+
+      // 3. compile the top-level forms of the main body, analyzed
+      // one by one as in streaming mode (the same code)
+      for (auto i = 1; i < ast.list.size(); i++) {
+        if (options.stackAllocate) {
+          escapeAnalysis.analyze(ast.list[i]);
+        }
+
+        gen(ast.list[i]);
+      }
+
+      compileMainEnd();
+    }
+
+    /*
+      compiles a program in streaming mode: each top-level form
+      is lowered into main (or its own function) right after it
+      is parsed, and its AST is freed before reading the next one.
+      generates the same code as `compile`.
+    */
+    void compileStream(std::string_view program) {
+      compileMainBegin();
+
+      // the implicit top-level (begin ...) block
+      resolver.beginScope();
+
+      parser->beginProgram(program);
+
+      while (parser->hasMoreForms()) {
+        auto form = parser->parseNextForm();
+
+        resolver.resolve(form);
+        bindings_.resize(resolver.slotsCount());
+
+        if (options.stackAllocate) {
+          escapeAnalysis.analyze(form);
+        }
+
+        gen(form);
+      }
+
+      parser->reset();
+
+      resolver.endScope();
+
+      compileMainEnd();
+    }
+
+    /*
+      starts the main function
+    */
+    void compileMainBegin() {
       fn = createFunction("main",
                           llvm::FunctionType::get(/* return type */ builder->getInt32Ty(),
-                                                  /* vararg */ false), GlobalEnv);
+                                                  /* vararg */ false));
 
       // setting version global variable
       createGlobalVar("VERSION", builder->getInt32(1));
+    }
 
-      // 2. compile the main body
-      auto result = gen(ast, GlobalEnv);
-
+    /*
+      finishes the main function
+    */
+    void compileMainEnd() {
       builder->CreateRet(builder->getInt32(0));
     }
 
     /*
       Main compile loop.
     */
-    llvm::Value* gen(const Exp& exp, Env env) { 
+    llvm::Value* gen(const Exp& exp) { 
       
       switch (exp.type) {
 
         case ExpType::SYMBOL: {
           // checking if expression is a boolean or not
-          if (exp.string == "true" || exp.string == "false") {
-            return builder->getInt1(exp.string == "true" ? true : false);
+          if (exp.id == KW_TRUE || exp.id == KW_FALSE) {
+            return builder->getInt1(exp.id == KW_TRUE ? true : false);
           } 
           else {
             // variables
-            auto varName = exp.string;
-            auto value = env->lookup(varName);
+            auto varName = llvm::StringRef(exp.string().data(), exp.string().size());
+            auto value = bindings_[exp.slot];
 
             // local variables
             // we check if "value" is of type llvm::AllocaInst i.e. is it allocated on the stack
             // if yes then we get pointer to llvm::AllocaInst type else a null pointer
             if (auto localVar = llvm::dyn_cast<llvm::AllocaInst>(value)) {
+              // instances allocated on the stack are bound directly
+              if (localVar->getAllocatedType()->isStructTy()) {
+                return localVar;
+              }
+
+
               // if casting is successful, we try to create load instruction
               // to keep the variable on the stack
-              return builder->CreateLoad(localVar->getAllocatedType(), localVar, varName.c_str());
+              return builder->CreateLoad(localVar->getAllocatedType(), localVar, varName);
             }
 
-            // global variables
+            // global variables, the constants are folded
             else if (auto globalVar = llvm::dyn_cast<llvm::GlobalVariable>(value)) {
+              if (globalVar->isConstant()) {
+                return globalVar->getInitializer();
+              }
+
               return builder->CreateLoad(globalVar->getInitializer()->getType(),
-                                        globalVar, varName.c_str());
+                                        globalVar, varName);
+            }
+
+            // lifted lambdas used as values (after their form in
+            // streaming mode): a closure
+            else if (liftedBindings_.count(exp.slot)) {
+              return createClosure(liftedBindings_[exp.slot], /* on stack */ false);
             }
 
             // functions
@@ -137,655 +395,1887 @@ class EvaLLVM {
         // numbers
         case ExpType::NUMBER:
           // we create instruction to get an integer of i32 type
-          // where the value is exp.number
+          // where the value is exp.number, i64 if it doesn't fit
+          if (exp.number != (int32_t)exp.number) {
+            return builder->getInt64(exp.number);
+          }
           return builder->getInt32(exp.number);
 
-        // strings
-        case ExpType::STRING: {
-          auto re = std::regex("\\\\n");
-          auto str = std::regex_replace(exp.string, re, "\n");
+        // floating point numbers: f64
+        case ExpType::FLOAT:
+          return llvm::ConstantFP::get(builder->getDoubleTy(), exp.decimal);
 
-          // CreateGlobalStringPtr: is used to create a string constant
-          // in the global scope of the program
-          return builder->CreateGlobalStringPtr(str);
-        }
+        // strings
+        // (escapes are already decoded by the parser)
+        case ExpType::STRING:
+          return getStringConstant(exp.string());
 
         // lists
         case ExpType::LIST:
-          auto tag = exp.list[0];
+          const auto& tag = exp.list[0];
 
-          // if we have + - * /
           if (tag.type == ExpType::SYMBOL) {
-            auto op = tag.string;
-            
-            // math binary ops
-            if (op == "+") {
-              GEN_BINARY_OP(CreateAdd, "tmpadd");
-            } else if (op == "-") {
-              GEN_BINARY_OP(CreateSub, "tmpsub");
-            } else if (op == "*") {
-              GEN_BINARY_OP(CreateMul, "tmpmul");
-            } else if (op == "/") {
-              GEN_BINARY_OP(CreateSDiv, "tmpdiv");
-            }
-
-            // comparison ops: unsigned
-            else if (op == ">") {
-              GEN_BINARY_OP(CreateICmpUGT, "tmpcmp");
-            } else if (op == "<") {
-              GEN_BINARY_OP(CreateICmpULT, "tmpcmp");
-            } else if (op == "==") {
-              GEN_BINARY_OP(CreateICmpEQ, "tmpcmp");
-            } else if (op == "!=") {
-              GEN_BINARY_OP(CreateICmpNE, "tmpcmp");
-            } else if (op == ">=") {
-              GEN_BINARY_OP(CreateICmpUGE, "tmpcmp");
-            } else if (op == "<=") {
-              GEN_BINARY_OP(CreateICmpULE, "tmpcmp");
+            // special forms: jump table indexed by the keyword id
+            if (tag.id < KEYWORDS_COUNT && specialForms_[tag.id] != nullptr) {
+              return (this->*specialForms_[tag.id])(exp);
             }
 
-            // branch instruction
-            // if (<condition> <then> <else>)
-            else if (op == "if") {
-              auto condition = gen(exp.list[1], env);
-
-              // blocks
-              auto thenBlock = createBB("then", fn);
-
-              // else, ifend blocks appended later
-              // to handle nested if-expressions
-              auto elseBlock = createBB("else");
-              auto ifEndBlock = createBB("ifend");
-
-              // condition branch
-              builder->CreateCondBr(condition, thenBlock, elseBlock);
-
-              // then branch
-              builder->SetInsertPoint(thenBlock);
-              auto thenRes = gen(exp.list[2], env);
-              builder->CreateBr(ifEndBlock);
-
-              // restoring the block to handle nested if-expression
-              // it is needed for the phi instruction
-              thenBlock = builder->GetInsertBlock();
-
-              // else branch
-              // append the block to the function now
-              fn->getBasicBlockList().push_back(elseBlock);
-              builder->SetInsertPoint(elseBlock);
-              auto elseRes = gen(exp.list[3], env);
-              builder->CreateBr(ifEndBlock);
-              
-              // restore the block for phi instruction
-              elseBlock = builder->GetInsertBlock();
-
-              // if-end block
-              fn->getBasicBlockList().push_back(ifEndBlock);
-              builder->SetInsertPoint(ifEndBlock);
-
-              // result of if expression
-              auto phi = builder->CreatePHI(thenRes->getType(), 2, "tmpif");
+            // function calls
+            return genCall(exp);
+          }
 
-              phi->addIncoming(thenRes, thenBlock);
-              phi->addIncoming(elseRes, elseBlock);
+          // method calls.
+          // ((method p getX) 2)
+          else if (isTaggedList(tag, KW_METHOD)) {
+            return genMethodCall(exp);
+          }
 
-              return phi;
-            }
+          // lambdas applied directly: ((lambda (x) (* x x)) 2)
+          else if (isTaggedList(tag, KW_LAMBDA)) {
+            return genLiftedCall(compileLambda(tag), exp);
+          }
 
-            // while loop
-            else if (op == "while") {
-              // condition
-              auto condBlock = createBB("cond", fn);
-              builder->CreateBr(condBlock);
+          // closures: ((prop p callback) 2)
+          else {
+            return genClosureCall(gen(tag), exp);
+          }
+      }
 
-              // body
-              auto bodyBlock = createBB("body");
-              auto loopEndBlock = createBB("loopend");
+      // unreachable
+      return builder->getInt32(0);
+    }
 
-              // compile the condition
-              builder->SetInsertPoint(condBlock);
-              auto cond = gen(exp.list[1], env);
+    /*
+      Special form handler: compiles a list tagged with a keyword.
+    */
+    using SpecialForm = llvm::Value* (EvaLLVM::*)(const Exp&);
 
-              // condition branch
-              builder->CreateCondBr(cond, bodyBlock, loopEndBlock);
+    /*
+      Registers special forms in the dispatch table.
+      New forms are added here, with their keyword in Symbol.h.
+    */
+    void setupSpecialForms() {
+      // math binary ops
+      specialForms_[KW_ADD] = &EvaLLVM::genAdd;
+      specialForms_[KW_SUB] = &EvaLLVM::genSub;
+      specialForms_[KW_MUL] = &EvaLLVM::genMul;
+      specialForms_[KW_DIV] = &EvaLLVM::genDiv;
+
+      // comparison ops
+      specialForms_[KW_GT] = &EvaLLVM::genGT;
+      specialForms_[KW_LT] = &EvaLLVM::genLT;
+      specialForms_[KW_EQ] = &EvaLLVM::genEQ;
+      specialForms_[KW_NE] = &EvaLLVM::genNE;
+      specialForms_[KW_GE] = &EvaLLVM::genGE;
+      specialForms_[KW_LE] = &EvaLLVM::genLE;
+
+      // control flow, declarations and blocks
+      specialForms_[KW_IF] = &EvaLLVM::genIf;
+      specialForms_[KW_WHILE] = &EvaLLVM::genWhile;
+      specialForms_[KW_FOR] = &EvaLLVM::genFor;
+      specialForms_[KW_BREAK] = &EvaLLVM::genBreak;
+      specialForms_[KW_CONTINUE] = &EvaLLVM::genContinue;
+      specialForms_[KW_DEF] = &EvaLLVM::genDef;
+      specialForms_[KW_LAMBDA] = &EvaLLVM::genLambda;
+      specialForms_[KW_VAR] = &EvaLLVM::genVar;
+      specialForms_[KW_CONST] = &EvaLLVM::genConst;
+      specialForms_[KW_SET] = &EvaLLVM::genSet;
+      specialForms_[KW_BEGIN] = &EvaLLVM::genBegin;
+
+      // external functions
+      specialForms_[KW_PRINTF] = &EvaLLVM::genPrintf;
+
+      // classes and objects
+      specialForms_[KW_CLASS] = &EvaLLVM::genClass;
+      specialForms_[KW_NEW] = &EvaLLVM::genNew;
+      specialForms_[KW_PROP] = &EvaLLVM::genProp;
+      specialForms_[KW_METHOD] = &EvaLLVM::genMethod;
+
+      // arrays
+      specialForms_[KW_NEW_ARRAY] = &EvaLLVM::genNewArray;
+      specialForms_[KW_AREF] = &EvaLLVM::genAref;
+      specialForms_[KW_ASET] = &EvaLLVM::genAset;
+      specialForms_[KW_LEN] = &EvaLLVM::genLen;
+    }
 
-              // body
-              fn->getBasicBlockList().push_back(bodyBlock);
-              builder->SetInsertPoint(bodyBlock);
-              gen(exp.list[2], env);
-              builder->CreateBr(condBlock);
+    // math binary ops: signed integers don't wrap (nsw)
+    llvm::Value* genAdd(const Exp& exp) { GEN_BINARY_OP(CreateNSWAdd, CreateFAdd, "tmpadd"); }
+    llvm::Value* genSub(const Exp& exp) { GEN_BINARY_OP(CreateNSWSub, CreateFSub, "tmpsub"); }
+    llvm::Value* genMul(const Exp& exp) { GEN_BINARY_OP(CreateNSWMul, CreateFMul, "tmpmul"); }
+    llvm::Value* genDiv(const Exp& exp) { GEN_BINARY_OP(CreateSDiv, CreateFDiv, "tmpdiv"); }
 
-              fn->getBasicBlockList().push_back(loopEndBlock);
-              builder->SetInsertPoint(loopEndBlock);
+    // comparison ops: signed, ordered for f64 (unordered !=)
+    llvm::Value* genGT(const Exp& exp) { GEN_BINARY_OP(CreateICmpSGT, CreateFCmpOGT, "tmpcmp"); }
+    llvm::Value* genLT(const Exp& exp) { GEN_BINARY_OP(CreateICmpSLT, CreateFCmpOLT, "tmpcmp"); }
+    llvm::Value* genEQ(const Exp& exp) { GEN_BINARY_OP(CreateICmpEQ, CreateFCmpOEQ, "tmpcmp"); }
+    llvm::Value* genNE(const Exp& exp) { GEN_BINARY_OP(CreateICmpNE, CreateFCmpUNE, "tmpcmp"); }
+    llvm::Value* genGE(const Exp& exp) { GEN_BINARY_OP(CreateICmpSGE, CreateFCmpOGE, "tmpcmp"); }
+    llvm::Value* genLE(const Exp& exp) { GEN_BINARY_OP(CreateICmpSLE, CreateFCmpOLE, "tmpcmp"); }
 
-              return builder->getInt32(0);
-            }
+    /*
+      Compiles the operands of a binary op,
+      promoted to their common numeric type.
+    */
+    std::pair<llvm::Value*, llvm::Value*> genOperands(const Exp& exp) {
+      auto op1 = gen(exp.list[1]);
+      auto op2 = gen(exp.list[2]);
 
-            // function declaration
-            // (def <name> <param> <body>)
-            if (op == "def") {
-              return compileFunction(exp, /* name */ exp.list[1].string, env);
-            }
-            
-            // variable declaration: (var a (+ b 1))
-            // typed version: (var (x number) 10)
-            // Note: locals are allocated on the stack
-            if (op == "var") {
-              
-              // we dont want to re initialize values during the class declaration
-              // as normal variables or overwrites due to var keyword.
-              // this is a special case for class fields, which are already defined
-              // during the class alocation.
-              if (cls != nullptr) {
-                return builder->getInt32(0);
-              }
-              
-              // getting name from the declaration
-              auto varNameDec = exp.list[1];
-              auto varName = extractVarName(varNameDec);
-
-              // special case for new keyword as it allocates a new variable.
-              if (isNew(exp.list[2])) {
-                auto instance = createInstance(exp.list[2], env, varName);
-                return env->define(varName, instance);
-              }
+      if (auto type_ = getCommonType(op1->getType(), op2->getType())) {
+        op1 = castValue(op1, type_);
+        op2 = castValue(op2, type_);
+      }
 
-              // init
-              auto init = gen(exp.list[2], env);
+      return {op1, op2};
+    }
 
-              // variable type
-              auto varType = extractVarType(varNameDec);
+    /*
+      Common type of two numbers: f64 if either is f64,
+      otherwise the widest integer. nullptr for non-numbers.
+    */
+    llvm::Type* getCommonType(llvm::Type* a, llvm::Type* b) {
+      if (!isNumberType(a) || !isNumberType(b)) {
+        return nullptr;
+      }
 
-              // variable
-              auto varBinding = allocVar(varName, varType, env);
+      if (a->isDoubleTy() || b->isDoubleTy()) {
+        return builder->getDoubleTy();
+      }
 
-              // setting variable value
-              return builder->CreateStore(init, varBinding);
-            }
+      return a->getIntegerBitWidth() >= b->getIntegerBitWidth() ? a : b;
+    }
 
-            // set: is used to update the value of a variable
-            else if (op == "set") {
-              // value
-              auto value = gen(exp.list[2], env);
+    bool isNumberType(llvm::Type* type_) {
+      return type_->isIntegerTy() || type_->isDoubleTy();
+    }
 
-              // properties
-              if (isProp(exp.list[1])) {
-                auto instance = gen(exp.list[1].list[1], env); // we get instance of the class
-                auto fieldName = exp.list[1].list[2].string; // we get field within the class whose value is to be modified
-                auto ptrName = std::string("p") + fieldName; // we give a name to the field inside the class
+    /*
+      Converts a value to a type: integers are sign extended or
+      truncated (booleans are zero extended), and converted to and
+      from f64 as signed. Pointers are bitcast, for sub-classes.
+    */
+    llvm::Value* castValue(llvm::Value* value, llvm::Type* type_) {
+      auto valueTy = value->getType();
 
-                auto cls = (llvm::StructType*)(instance->getType()->getContainedType(0)); // we get a pointer to the instance
+      if (valueTy == type_) {
+        return value;
+      }
 
-                // we get the offset factor from the start of the struct location
-                auto fieldIdx = getFieldIndex(cls, fieldName);
-                
-                // we offset from the starting location of the struct 
-                // pointer to point to where the field is stored on the heap
-                auto address = builder->CreateStructGEP(cls, instance, fieldIdx, ptrName);
+      bool isBool = valueTy->isIntegerTy(1);
 
-                // we store the actual value using value
-                // and address contains a pointer to where the value must be stored
-                builder->CreateStore(value, address);
+      if (valueTy->isIntegerTy() && type_->isIntegerTy()) {
+        return isBool ? builder->CreateZExt(value, type_) : builder->CreateSExtOrTrunc(value, type_);
+      }
 
-                return value;
-              }
-              
-              // variables
-              else {
-                // get the name of the variable to be updated
-                auto varName = exp.list[1].string;
+      if (valueTy->isIntegerTy() && type_->isDoubleTy()) {
+        return isBool ? builder->CreateUIToFP(value, type_) : builder->CreateSIToFP(value, type_);
+      }
 
-                // lookup where in the permissible env scope chain can
-                // we find the variable to be updated with
-                auto varBinding = env->lookup(varName);
+      if (valueTy->isDoubleTy() && type_->isIntegerTy()) {
+        return builder->CreateFPToSI(value, type_);
+      }
 
-                // set the value
-                builder->CreateStore(value, varBinding);
+      if (valueTy->isPointerTy() && type_->isPointerTy()) {
+        return builder->CreateBitCast(value, type_);
+      }
 
-                return value;
-              }
-            }
+      return value;
+    }
 
-            // blocks
-            // starts with the begin keyword (begin <block>)
-            else if (op == "begin") {
-              auto blockEnv = std::make_shared<Environment>(
-                std::map<std::string, llvm::Value*>{}, env);
+    /*
+      branch instruction
+      (if <condition> <then> <else>)
+    */
+    llvm::Value* genIf(const Exp& exp) {
+      auto condition = gen(exp.list[1]);
 
-              llvm::Value* blockRes;
+      // blocks
+      auto thenBlock = createBB("then", fn);
 
-              for (auto i = 1; i < exp.list.size(); i++) {
-                blockRes = gen(exp.list[i], blockEnv);
-              }
-              return blockRes;
-            }
+      // else, ifend blocks appended later
+      // to handle nested if-expressions
+      auto elseBlock = createBB("else");
+      auto ifEndBlock = createBB("ifend");
 
-            // external functions
-            else if (op == "printf") {
-              auto printfFn = module->getFunction("printf");
+      // condition branch
+      builder->CreateCondBr(condition, thenBlock, elseBlock);
 
-              // args:
-              std::vector<llvm::Value*> args{};
+      // then branch
+      builder->SetInsertPoint(thenBlock);
+      auto thenRes = gen(exp.list[2]);
 
-              // gather the args
-              for (auto i = 1; i < exp.list.size(); i++) {
-                args.push_back(gen(exp.list[i], env));
-              }
+      // a branch ending in a tail call doesn't reach the end
+      auto thenReturns = blockTerminated();
+      if (!thenReturns) {
+        builder->CreateBr(ifEndBlock);
+      }
 
-              // invoke the printf function with the array of collected args
-              return builder->CreateCall(printfFn, args);
-            }
+      // restoring the block to handle nested if-expression
+      // it is needed for the phi instruction
+      thenBlock = builder->GetInsertBlock();
 
-            // class declaration
-            // Example:
-            // (class A <super> <body>)
-            else if (op == "class") {
-              auto name = exp.list[1].string;
-
-              // getting the parent class name.
-              // if base class inherits parent class
-              auto parent = exp.list[2].string == "null" ? nullptr : getClassByName(exp.list[2].string);
-
-              // compiling the class.
-              cls = llvm::StructType::create(*ctx, name);
-
-              if (parent != nullptr) {
-                inheritClass(cls, parent);
-              } else {
-                // allocate info for new class.
-                classMap_[name] = {
-                  /* class */ cls,
-                  /* parent */ parent,
-                  /* fields */ {},
-                  /* methods */ {}};
-              }
+      // else branch
+      // append the block to the function now
+      fn->getBasicBlockList().push_back(elseBlock);
+      builder->SetInsertPoint(elseBlock);
+      auto elseRes = gen(exp.list[3]);
 
-              // add fields and methods in the class into class info
-              buildClassInfo(cls, exp, env);
+      auto elseReturns = blockTerminated();
+      if (!elseReturns) {
+        builder->CreateBr(ifEndBlock);
+      }
+      
+      // restore the block for phi instruction
+      elseBlock = builder->GetInsertBlock();
 
-              // compile the body
-              gen(exp.list[3], env);
+      // both branches returned: the if is terminated as well
+      if (thenReturns && elseReturns) {
+        delete ifEndBlock;
+        return thenRes;
+      }
 
-              // reset the class after compiling, so normal fns
-              // dont pick the class name prefix.
-              cls = nullptr;
+      // numbers of different types: promote before the branches
+      auto type_ = getCommonType(thenRes->getType(), elseRes->getType());
+      if (type_ != nullptr && !thenReturns && !elseReturns) {
+        builder->SetInsertPoint(thenBlock->getTerminator());
+        thenRes = castValue(thenRes, type_);
+        builder->SetInsertPoint(elseBlock->getTerminator());
+        elseRes = castValue(elseRes, type_);
+      }
 
-              return builder->getInt32(0);
-            }
+      // if-end block
+      fn->getBasicBlockList().push_back(ifEndBlock);
+      builder->SetInsertPoint(ifEndBlock);
 
-            // object instantiation
-            // (new <class> <args)
-            else if (op == "new") {
-              return createInstance(exp, env, "");
-            }
+      // a single branch reaches the end
+      if (thenReturns || elseReturns) {
+        return thenReturns ? elseRes : thenRes;
+      }
 
-            // property of a class access
-            // (prop <instance> <name>)
-            else if (op == "prop") {
-              // instance
-              auto instance = gen(exp.list[1], env);
-              auto fieldName = exp.list[2].string;
-              auto ptrName = std::string("p") + fieldName;
+      // result of if expression
+      auto phi = builder->CreatePHI(thenRes->getType(), 2, "tmpif");
 
-              // instance->getType(): gives us Point*
-              // instance->getType()->getContainedType(): 
-              // get us the dereferenced pointer i.e. Point.
-              auto cls = (llvm::StructType*)instance->getType()->getContainedType(0);
+      phi->addIncoming(thenRes, thenBlock);
+      phi->addIncoming(elseRes, elseBlock);
 
-              auto fieldIdx = getFieldIndex(cls, fieldName);
+      return phi;
+    }
 
-              auto address = builder->CreateStructGEP(cls, instance, fieldIdx, ptrName);
+    /*
+      while loop
+      (while <condition> <body>)
+    */
+    llvm::Value* genWhile(const Exp& exp) {
+      // condition
+      auto condBlock = createBB("cond", fn);
+      builder->CreateBr(condBlock);
 
-              return builder->CreateLoad(cls->getElementType(fieldIdx), address, fieldName);
-            }
+      // body
+      auto bodyBlock = createBB("body");
+      auto loopEndBlock = createBB("loopend");
 
-            // method access
-            // (method <instance> <name>) or (method (super <class>) <name>)
-            else if (op == "method") {
-              auto methodName = exp.list[2].string;
-
-              llvm::StructType* cls;
-              llvm::Value* vTable;
-              llvm::StructType* vTableTy;
-
-              // (method (super <class>) <name>)
-              if (isSuper(exp.list[1])) {
-                auto className = exp.list[1].list[1].string; // get class name
-                cls = classMap_[className].parent; // get the parent class of current class from classMap
-                auto parentName = std::string{cls->getName().data()}; // get parent classes name
-                vTable = module->getNamedGlobal(parentName + "_vTable"); // get the vTable associated with the parent class
-                vTableTy = llvm::StructType::getTypeByName(*ctx, parentName + "_vTable"); // used to get layout of fn pointers of the parent class
-              }
+      // compile the condition
+      builder->SetInsertPoint(condBlock);
+      auto cond = gen(exp.list[1]);
 
-              else {
-                // instance
-                auto instance = gen(exp.list[1], env);
+      // condition branch
+      builder->CreateCondBr(cond, bodyBlock, loopEndBlock);
 
-                // get struct pointer to the class
-                cls = (llvm::StructType*)(instance->getType()->getContainedType(0));
+      // body: continue re-checks the condition
+      fn->getBasicBlockList().push_back(bodyBlock);
+      builder->SetInsertPoint(bodyBlock);
+      loops_.push_back({condBlock, loopEndBlock});
+      gen(exp.list[2]);
+      loops_.pop_back();
+      builder->CreateBr(condBlock);
 
-                // load vTable
-                auto vTableAddr = builder->CreateStructGEP(cls, instance, VTABLE_INDEX);
+      fn->getBasicBlockList().push_back(loopEndBlock);
+      builder->SetInsertPoint(loopEndBlock);
 
-                vTable = builder->CreateLoad(cls->getElementType(VTABLE_INDEX), vTableAddr, "vt");
+      return builder->getInt32(0);
+    }
 
-                vTableTy = (llvm::StructType*)(vTable->getType()->getContainedType(0));
-              }
+    /*
+      counted loop, from start (included) to end (excluded)
+      (for (<name> <start> <end> [<step>]) <body> [:unroll <n>] [:vectorize])
+
+      the bounds are integers, evaluated once; the step is a non-zero
+      constant, and the loop counts down when it is negative. Emitted
+      in the rotated loop form: the preheader tests the first
+      iteration, the body starts with the induction variable (a phi,
+      which can't be set), and the single latch tests the distance
+      left to the end, so the step never overflows past it. The back
+      edge carries the options as llvm.loop metadata.
+    */
+    llvm::Value* genFor(const Exp& exp) {
+      const auto& header = exp.list[1];
 
-              // get offset from vTable start to our desired method name
-              auto methodIdx = getMethodIndex(cls, methodName);
+      if (exp.list.size() < 3 || header.type != ExpType::LIST || header.list.size() < 3 ||
+          header.list.size() > 4 || header.list[0].type != ExpType::SYMBOL) {
+        DIE << "[EvaLLVM]: The for loop expects (for (<name> <start> <end> [<step>]) <body>)" << std::endl;
+      }
 
-              // get the type of the method from our vTable
-              auto methodTy = (llvm::FunctionType*)vTableTy->getElementType(methodIdx);
+      const auto& varName = header.list[0];
 
-              // get the address of th method using GEP instruction
-              auto methodAddr = builder->CreateStructGEP(vTableTy, vTable, methodIdx);
-              
-              return builder->CreateLoad(methodTy, methodAddr);
-            }
+      auto start = gen(header.list[1]);
+      auto end = gen(header.list[2]);
+      auto step = header.list.size() > 3 ? gen(header.list[3]) : builder->getInt32(1);
 
-            // function calls
-            else {
-              auto callable = gen(exp.list[0], env);
+      auto type_ = getCommonType(start->getType(), end->getType());
+      type_ = type_ == nullptr ? nullptr : getCommonType(type_, step->getType());
 
-              // raw function or a functor (callable class)
-              auto callableTy = callable->getType()->getContainedType(0);
+      if (type_ == nullptr || !type_->isIntegerTy() || type_->isIntegerTy(1)) {
+        DIE << "[EvaLLVM]: The bounds of the for loop " << varName.string() << " must be integers" << std::endl;
+      }
 
-              std::vector<llvm::Value*> args{};
-              auto argIdx = 0;
+      start = castValue(start, type_);
+      end = castValue(end, type_);
+      step = castValue(step, type_);
 
-              if (callableTy->isStructTy()) {
-                auto cls = (llvm::StructType*)callableTy;
+      auto stepValue = llvm::dyn_cast<llvm::ConstantInt>(step);
 
-                std::string className{cls->getName().data()};
+      if (stepValue == nullptr || stepValue->isZero()) {
+        DIE << "[EvaLLVM]: The step of the for loop " << varName.string() << " must be a non-zero constant"
+            << std::endl;
+      }
 
-                // push the functor as the fust `self` arg.
-                args.push_back(callable);
-                argIdx++;
+      auto countDown = stepValue->isNegative();
+
+      // the distance covered by one step, unsigned
+      auto stepSize = builder->getInt(stepValue->getValue().abs());
+
+      auto preheader = builder->GetInsertBlock();
+      auto bodyBlock = createBB("for.body", fn);
+      auto latchBlock = createBB("for.latch");
+      auto loopEndBlock = createBB("for.end");
+
+      // preheader: the first iteration
+      auto enter = countDown ? builder->CreateICmpSGT(start, end) : builder->CreateICmpSLT(start, end);
+      builder->CreateCondBr(enter, bodyBlock, loopEndBlock);
+
+      // body: induction variable, continue goes to the latch
+      builder->SetInsertPoint(bodyBlock);
+      auto var = builder->CreatePHI(type_, 2, llvm::StringRef(varName.string().data(), varName.string().size()));
+      var->addIncoming(start, preheader);
+
+      bindings_[varName.slot] = var;
+      loops_.push_back({latchBlock, loopEndBlock});
+      gen(exp.list[2]);
+      loops_.pop_back();
+      builder->CreateBr(latchBlock);
+
+      // latch: the single back edge, taken while more than one step
+      // is left to the end (the distance is positive, so unsigned)
+      fn->getBasicBlockList().push_back(latchBlock);
+      builder->SetInsertPoint(latchBlock);
+      auto left = countDown ? builder->CreateSub(var, end, "left") : builder->CreateSub(end, var, "left");
+      auto cond = builder->CreateICmpUGT(left, stepSize);
+      // no signed wrap: only used when the next value is within the bounds
+      auto next = builder->CreateNSWAdd(var, step, "next");
+      auto backEdge = builder->CreateCondBr(cond, bodyBlock, loopEndBlock);
+      var->addIncoming(next, latchBlock);
+
+      if (auto loopId = getLoopMetadata(exp, 3)) {
+        backEdge->setMetadata(llvm::LLVMContext::MD_loop, loopId);
+      }
 
-                // TODO: support inheritance - load method from the vTable
-                callable = module->getFunction(className + "___call__");
-              }
+      fn->getBasicBlockList().push_back(loopEndBlock);
+      builder->SetInsertPoint(loopEndBlock);
 
-              auto fn = (llvm::Function*)callable;
+      return builder->getInt32(0);
+    }
 
-              for (auto i = 1; i < exp.list.size(); i++, argIdx++) {
-                auto argValue = gen(exp.list[i], env);
+    /*
+      Loop options, from the `from` item of the loop:
+      :unroll <n> (1 disables unrolling), :vectorize and
+      :vectorize-width <n>. nullptr without options.
+    */
+    llvm::MDNode* getLoopMetadata(const Exp& exp, size_t from) {
+      // the first operand is the loop id itself
+      std::vector<llvm::Metadata*> operands{nullptr};
+
+      auto option = [&](const char* name, llvm::Constant* value = nullptr) {
+        std::vector<llvm::Metadata*> items{llvm::MDString::get(*ctx, name)};
+        if (value != nullptr) {
+          items.push_back(llvm::ConstantAsMetadata::get(value));
+        }
+        operands.push_back(llvm::MDNode::get(*ctx, items));
+      };
 
-                auto paramTy = fn->getArg(argIdx)->getType();
-                auto bitCastArgVal = builder->CreateBitCast(argValue, paramTy);
+      auto count = [&](size_t i) -> uint32_t {
+        if (i >= exp.list.size() || exp.list[i].type != ExpType::NUMBER || exp.list[i].number < 1) {
+          DIE << "[EvaLLVM]: The loop option " << exp.list[i - 1].string() << " expects a positive count" << std::endl;
+        }
+        return exp.list[i].number;
+      };
 
-                args.push_back(bitCastArgVal);
-              }
+      for (auto i = from; i < exp.list.size(); i++) {
+        auto name = exp.list[i].type == ExpType::SYMBOL ? exp.list[i].string() : std::string_view{};
 
-              return builder->CreateCall(fn, args);
-            }
+        if (name == ":unroll") {
+          auto n = count(++i);
+          if (n == 1) {
+            option("llvm.loop.unroll.disable");
+          } else {
+            option("llvm.loop.unroll.count", builder->getInt32(n));
           }
+        } else if (name == ":vectorize") {
+          option("llvm.loop.vectorize.enable", builder->getTrue());
+        } else if (name == ":vectorize-width") {
+          option("llvm.loop.vectorize.enable", builder->getTrue());
+          option("llvm.loop.vectorize.width", builder->getInt32(count(++i)));
+        } else {
+          DIE << "[EvaLLVM]: Unknown loop option " << name << std::endl;
+        }
+      }
 
-          // method calls.
-          // ((method p getX) 2)
-          else {
-            auto loadedMethod = (llvm::LoadInst*)gen(exp.list[0], env);
-
-            auto fnTy = (llvm::FunctionType*)(loadedMethod->getPointerOperand()->getType()->getContainedType(0)->getContainedType(0));
-
-            std::vector<llvm::Value*> args{};
-
-            for (auto i = 1; i < exp.list.size(); i++) {
-              auto argValue = gen(exp.list[i], env);
-
-              // we need to cast to param type to support sub-classes.
-              // we should be able to pass Point3D instance for the type.
-              // of the parent class Point:
-              auto paramTy = fnTy->getParamType(i - 1);
-
-              if (argValue->getType() != paramTy) {
-                auto bitCastArgVal = builder->CreateBitCast(argValue, paramTy);
-                args.push_back(bitCastArgVal);
-              } else {
-                args.push_back(argValue);
-              }
-            }
-
-            return builder->CreateCall(fnTy, loadedMethod, args);
-          }
+      if (operands.size() == 1) {
+        return nullptr;
       }
 
-      // unreachable
-      return builder->getInt32(0);
+      auto loopId = llvm::MDNode::getDistinct(*ctx, operands);
+      loopId->replaceOperandWith(0, loopId);
+      return loopId;
     }
 
     /*
-      Returns field index.
+      exits the innermost loop
+      (break)
     */
-    size_t getFieldIndex(llvm::StructType* cls, const std::string& fieldName) {
-      auto fields = &classMap_[cls->getName().data()].fieldsMap;
-      auto it = fields->find(fieldName);
-      return std::distance(fields->begin(), it) + RESERVED_FIELDS_COUNT;
+    llvm::Value* genBreak(const Exp& exp) {
+      return genLoopJump(exp, /* break */ true);
     }
 
     /*
-      Returns method index.
+      next iteration of the innermost loop
+      (continue)
     */
-    size_t getMethodIndex(llvm::StructType* cls, const std::string& methodName) {
-      auto methods = &classMap_[cls->getName().data()].methodsMap;
-      auto it = methods->find(methodName);
-      return std::distance(methods->begin(), it);
+    llvm::Value* genContinue(const Exp& exp) {
+      return genLoopJump(exp, /* break */ false);
     }
 
     /*
-      Creates an instance of a class.
+      Jumps out of the body of the innermost loop, the code
+      which follows in the block is unreachable.
     */
-    llvm::Value* createInstance(const Exp& exp, Env env, const std::string& name) {
-      auto className = exp.list[1].string;
-      auto cls = getClassByName(className);
-
-      if (cls == nullptr) {
-        DIE << "[EvaLLVM]: Unknown class " << cls;
+    llvm::Value* genLoopJump(const Exp& exp, bool isBreak) {
+      if (loops_.empty()) {
+        DIE << "[EvaLLVM]: " << exp.list[0].string() << " outside of a loop" << std::endl;
       }
 
-      // currently instance allocation is on stack.
-      // TODO: heap allocation
-      // auto instance = name.empty() ? 
-      // builder->CreateAlloca(cls) : builder->CreateAlloca(cls, 0, name);
-
-      // we are going to use malloc here as an external function
-      // to reuse memory allocation a garbage collection
-      auto instance = mallocInstance(cls, name);
+      builder->CreateBr(isBreak ? loops_.back().exit : loops_.back().next);
 
-      // call constructor after instance has been created
-      auto ctor = module->getFunction(className + "_constructor");
+      builder->SetInsertPoint(createBB(isBreak ? "after.break" : "after.continue", fn));
 
-      std::vector<llvm::Value*> args{instance};
+      return builder->getInt32(0);
+    }
 
-      for (auto i = 2; i < exp.list.size(); i++) {
-        args.push_back(gen(exp.list[i], env));
+    /*
+      function declaration
+      (def <name> <param> <body>)
+    */
+    llvm::Value* genDef(const Exp& exp) {
+      // functions can be evaluated at compile time (not the methods)
+      if (cls == nullptr) {
+        constEvaluator.defineFunction(exp);
       }
 
-      builder->CreateCall(ctor, args);
+      return compileFunction(exp, /* name */ std::string(exp.list[1].string()));
+    }
 
-      return instance;
+    /*
+      closure: the lifted lambda, with an environment holding
+      the captured values, on the stack if it doesn't escape
+      (lambda <params> [-> <type>] <body>)
+    */
+    llvm::Value* genLambda(const Exp& exp) {
+      return createClosure(compileLambda(exp), options.stackAllocate && !escapeAnalysis.escapes(exp));
     }
 
     /*
-      Allocates an object of given class on the heap.
+      variable declaration: (var a (+ b 1))
+      typed version: (var (x number) 10)
+      untyped variables take the type of the init.
+      Note: locals are allocated on the stack
     */
-    llvm::Value* mallocInstance(llvm::StructType* cls, const std::string& name) {
-      auto typeSize = builder->getInt64(getTypeSize(cls));
+    llvm::Value* genVar(const Exp& exp) {
+      // we dont want to re initialize values during the class declaration
+      // as normal variables or overwrites due to var keyword.
+      // this is a special case for class fields, which are already defined
+      // during the class alocation.
+      if (cls != nullptr) {
+        return builder->getInt32(0);
+      }
       
-      // will give us a void*
-      auto mallocPtr = builder->CreateCall(module->getFunction("GC_malloc"), typeSize, name);
+      // getting name from the declaration
+      const auto& varNameDec = exp.list[1];
+      auto varName = extractVarName(varNameDec);
+
+      // special case for new keyword as it allocates a new variable.
+      if (isNew(exp.list[2])) {
+        auto instance = createInstance(exp.list[2], varName);
+        return bindings_[extractVarSlot(varNameDec)] = instance;
+      }
 
-      // need to convert pointer to our class pointer type
-      // void* -> Point*
-      auto instance = builder->CreatePointerCast(mallocPtr, cls->getPointerTo());
+      // lambdas which are only called: the calls are direct,
+      // with the captured values
+      if (isTaggedList(exp.list[2], KW_LAMBDA) && escapeAnalysis.lifted(exp.list[2])) {
+        auto lambda = compileLambda(exp.list[2]);
+        liftedBindings_[extractVarSlot(varNameDec)] = lambda;
+        return bindings_[extractVarSlot(varNameDec)] = lambda.fn;
+      }
 
-      // install the vTable to lookup methods.
-      std::string className{cls->getName().data()};
-      auto vTableName = className + "_vTable";
-      auto vTableAddr = builder->CreateStructGEP(cls, instance, VTABLE_INDEX);
-      auto vTable = module->getNamedGlobal(vTableName);
-      builder->CreateStore(vTable, vTableAddr);
+      // init
+      auto init = gen(exp.list[2]);
 
-      return instance;
+      // variable type
+      auto varType = varNameDec.type == ExpType::LIST ? extractVarType(varNameDec) : init->getType();
+
+      // variable
+      auto varBinding = allocVar(varName, extractVarSlot(varNameDec), varType);
+
+      // setting variable value
+      return builder->CreateStore(castValue(init, varType), varBinding);
     }
 
     /*
-      Returns size of a type in bytes.
+      constant: evaluated at compile time, a constant global
+      (const <name> <exp>)
     */
-    size_t getTypeSize(llvm::Type* type_) {
-      return module->getDataLayout().getTypeAllocSize(type_);
+    llvm::Value* genConst(const Exp& exp) {
+      const auto& name = exp.list[1];
+
+      auto value = constEvaluator.evaluate(exp.list[2], options.constEvalSteps);
+
+      if (!value) {
+        DIE << "[EvaLLVM]: The value of the constant " << name.string()
+            << " can't be computed at compile time" << std::endl;
+      }
+
+      constEvaluator.defineConstant(name.slot, *value);
+
+      auto init = getConstant(*value);
+      auto constant = new llvm::GlobalVariable(*module, init->getType(), /* isConstant */ true,
+                                               llvm::GlobalValue::InternalLinkage, init,
+                                               std::string(name.string()));
+
+      bindings_[name.slot] = constant;
+
+      return init;
     }
 
     /*
-      Inherits parent class fields.
+      set: is used to update the value of a variable
+      (set <name> <value>) or (set (prop <instance> <field>) <value>)
     */
-    void inheritClass(llvm::StructType* cls, llvm::StructType* parent) {
-      auto parentClassInfo = &classMap_[parent->getName().data()];
+    llvm::Value* genSet(const Exp& exp) {
+      // value
+      auto value = gen(exp.list[2]);
 
-      // inherit the field and method names.
-      classMap_[cls->getName().data()] = {
+      // properties
+      if (isProp(exp.list[1])) {
+        auto instance = gen(exp.list[1].list[1]); // we get instance of the class
+        const auto& field = exp.list[1].list[2]; // we get field within the class whose value is to be modified
+        auto ptrName = std::string("p").append(field.string()); // we give a name to the field inside the class
+
+        auto cls = (llvm::StructType*)(instance->getType()->getContainedType(0)); // we get a pointer to the instance
+
+        // we get the offset factor from the start of the struct location
+        auto fieldIdx = getFieldIndex(cls, field.id);
+        
+        // we offset from the starting location of the struct 
+        // pointer to point to where the field is stored on the heap
+        auto address = builder->CreateStructGEP(cls, instance, fieldIdx, ptrName);
+
+        // we store the actual value using value
+        // and address contains a pointer to where the value must be stored
+        auto fieldTy = cls->getElementType(fieldIdx);
+        builder->CreateStore(castValue(value, fieldTy), address);
+
+        // the collector remembers the old -> young pointers
+        if (isGCPointerType(fieldTy)) {
+          auto barrier = module->getFunction("eva_gc_write_barrier");
+          builder->CreateCall(barrier, builder->CreateBitCast(address, barrier->getArg(0)->getType()));
+        }
+
+        return value;
+      }
+      
+      // variables
+      else {
+        // the binding the variable was resolved to
+        auto varBinding = bindings_[exp.list[1].slot];
+
+        if (llvm::isa<llvm::PHINode>(varBinding)) {
+          DIE << "[EvaLLVM]: Cannot set the loop variable " << exp.list[1].string() << std::endl;
+        }
+
+        if (liftedBindings_.count(exp.list[1].slot)) {
+          DIE << "[EvaLLVM]: Cannot set the lambda " << exp.list[1].string() << std::endl;
+        }
+
+        auto globalVar = llvm::dyn_cast<llvm::GlobalVariable>(varBinding);
+        if (globalVar != nullptr && globalVar->isConstant()) {
+          DIE << "[EvaLLVM]: Cannot set the constant " << exp.list[1].string() << std::endl;
+        }
+
+        // converted to the variable type
+        if (auto localVar = llvm::dyn_cast<llvm::AllocaInst>(varBinding)) {
+          value = castValue(value, localVar->getAllocatedType());
+        } else if (auto globalVar = llvm::dyn_cast<llvm::GlobalVariable>(varBinding)) {
+          value = castValue(value, globalVar->getValueType());
+        }
+
+        // set the value
+        builder->CreateStore(value, varBinding);
+
+        return value;
+      }
+    }
+
+    /*
+      blocks
+      starts with the begin keyword (begin <block>)
+    */
+    llvm::Value* genBegin(const Exp& exp) {
+      llvm::Value* blockRes;
+
+      for (auto i = 1; i < exp.list.size(); i++) {
+        blockRes = gen(exp.list[i]);
+      }
+      return blockRes;
+    }
+
+    /*
+      external functions
+      (printf <format> <args>)
+    */
+    llvm::Value* genPrintf(const Exp& exp) {
+      auto printfFn = module->getFunction("printf");
+
+      // args:
+      std::vector<llvm::Value*> args{};
+
+      // gather the args
+      for (auto i = 1; i < exp.list.size(); i++) {
+        args.push_back(gen(exp.list[i]));
+      }
+
+      // invoke the printf function with the array of collected args
+      return builder->CreateCall(printfFn, args);
+    }
+
+    /*
+      class declaration
+      Example:
+      (class A <super> <body>)
+    */
+    llvm::Value* genClass(const Exp& exp) {
+      auto name = std::string(exp.list[1].string());
+
+      // getting the parent class name.
+      // if base class inherits parent class
+      auto parent = exp.list[2].id == KW_NULL_ ? nullptr : getClassByName(std::string(exp.list[2].string()));
+
+      // compiling the class.
+      cls = llvm::StructType::create(*ctx, name);
+
+      if (parent != nullptr) {
+        inheritClass(cls, parent);
+      } else {
+        // allocate info for new class.
+        auto& classInfo = classMap_[exp.list[1].id];
+        classInfo = ClassInfo();
+        classInfo.cls = cls;
+        classInfo.parent = parent;
+      }
+
+      // add fields and methods in the class into class info
+      buildClassInfo(cls, exp);
+
+      // compile the body
+      gen(exp.list[3]);
+
+      // reset the class after compiling, so normal fns
+      // dont pick the class name prefix.
+      cls = nullptr;
+
+      return builder->getInt32(0);
+    }
+
+    /*
+      object instantiation
+      (new <class> <args>)
+    */
+    llvm::Value* genNew(const Exp& exp) {
+      return createInstance(exp, "");
+    }
+
+    /*
+      property of a class access
+      (prop <instance> <name>)
+    */
+    llvm::Value* genProp(const Exp& exp) {
+      // instance
+      auto instance = gen(exp.list[1]);
+      const auto& field = exp.list[2];
+      auto ptrName = std::string("p").append(field.string());
+
+      // instance->getType(): gives us Point*
+      // instance->getType()->getContainedType(): 
+      // get us the dereferenced pointer i.e. Point.
+      auto cls = (llvm::StructType*)instance->getType()->getContainedType(0);
+
+      auto fieldIdx = getFieldIndex(cls, field.id);
+
+      auto address = builder->CreateStructGEP(cls, instance, fieldIdx, ptrName);
+
+      return builder->CreateLoad(cls->getElementType(fieldIdx), address, llvm::StringRef(field.string().data(), field.string().size()));
+    }
+
+    /*
+      method access
+      (method <instance> <name>) or (method (super <class>) <name>)
+    */
+    llvm::Value* genMethod(const Exp& exp) {
+      auto methodName = exp.list[2].id;
+
+      llvm::StructType* cls;
+      llvm::Value* vTable;
+      llvm::StructType* vTableTy;
+
+      // (method (super <class>) <name>)
+      if (isSuper(exp.list[1])) {
+        auto className = exp.list[1].list[1].id; // get class name
+        cls = classMap_[className].parent; // get the parent class of current class from classMap
+        auto parentName = std::string{cls->getName().data()}; // get parent classes name
+        vTable = module->getNamedGlobal(parentName + "_vTable"); // get the vTable associated with the parent class
+        vTableTy = llvm::StructType::getTypeByName(*ctx, parentName + "_vTable"); // used to get layout of fn pointers of the parent class
+      }
+
+      else {
+        // instance
+        auto instance = gen(exp.list[1]);
+
+        // get struct pointer to the class
+        cls = (llvm::StructType*)(instance->getType()->getContainedType(0));
+
+        // load vTable
+        auto vTableAddr = builder->CreateStructGEP(cls, instance, VTABLE_INDEX);
+
+        // the vTable of an object never changes after construction
+        auto vTableLoad = builder->CreateLoad(cls->getElementType(VTABLE_INDEX), vTableAddr, "vt");
+        vTableLoad->setMetadata(llvm::LLVMContext::MD_invariant_group, llvm::MDNode::get(*ctx, {}));
+        vTable = vTableLoad;
+
+        vTableTy = (llvm::StructType*)(vTable->getType()->getContainedType(0));
+
+        // the vTable is compatible with the static class: lets
+        // WholeProgramDevirt resolve the call from the hierarchy
+        auto typeTest = builder->CreateCall(
+          llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::type_test),
+          {builder->CreateBitCast(vTable, builder->getInt8PtrTy()),
+           llvm::MetadataAsValue::get(*ctx, getTypeId(cls))});
+        builder->CreateAssumption(typeTest);
+      }
+
+      // get offset from vTable start to our desired method name
+      auto methodIdx = getMethodIndex(cls, methodName);
+
+      // get the type of the method from our vTable
+      auto methodTy = (llvm::FunctionType*)vTableTy->getElementType(methodIdx);
+
+      // get the address of th method using GEP instruction
+      auto methodAddr = builder->CreateStructGEP(vTableTy, vTable, methodIdx);
+
+      // vTables are constant
+      auto method = builder->CreateLoad(methodTy, methodAddr);
+      method->setMetadata(llvm::LLVMContext::MD_invariant_load, llvm::MDNode::get(*ctx, {}));
+
+      return method;
+    }
+
+    /*
+      array allocation, the elements are zeroed
+      (new-array <type> <length>)
+    */
+    llvm::Value* genNewArray(const Exp& exp) {
+      auto arrayTy = getArrayType(getTypeFromExp(exp.list[1]));
+      std::string arrayName{arrayTy->getName().data()};
+
+      auto length = castValue(gen(exp.list[2]), builder->getInt64Ty());
+
+      // the runtime sets the length
+      auto allocArray = module->getFunction(options.preciseGC ? "eva_gc_alloc_array" : "eva_alloc_array");
+      auto memory = builder->CreateCall(allocArray, {module->getNamedGlobal(arrayName + "_descriptor"), length});
+
+      auto array = builder->CreatePointerCast(memory, getClassPointerType(arrayTy));
+
+      installVTable(arrayTy, array);
+
+      return array;
+    }
+
+    /*
+      array element
+      (aref <array> <index>)
+    */
+    llvm::Value* genAref(const Exp& exp) {
+      auto array = gen(exp.list[1]);
+      auto arrayTy = (llvm::StructType*)array->getType()->getContainedType(0);
+
+      auto address = getElementAddress(array, gen(exp.list[2]));
+
+      return builder->CreateLoad(getElementType(arrayTy), address, "elem");
+    }
+
+    /*
+      sets an array element
+      (aset <array> <index> <value>)
+    */
+    llvm::Value* genAset(const Exp& exp) {
+      auto array = gen(exp.list[1]);
+      auto arrayTy = (llvm::StructType*)array->getType()->getContainedType(0);
+      auto elementTy = getElementType(arrayTy);
+
+      auto address = getElementAddress(array, gen(exp.list[2]));
+      auto value = gen(exp.list[3]);
+
+      builder->CreateStore(castValue(value, elementTy), address);
+
+      // the collector remembers the old -> young pointers
+      if (isGCPointerType(elementTy)) {
+        auto barrier = module->getFunction("eva_gc_write_barrier");
+        builder->CreateCall(barrier, builder->CreateBitCast(address, barrier->getArg(0)->getType()));
+      }
+
+      return value;
+    }
+
+    /*
+      array length, i64
+      (len <array>)
+    */
+    llvm::Value* genLen(const Exp& exp) {
+      return getArrayLength(gen(exp.list[1]));
+    }
+
+    /*
+      Loads the length of an array. It never changes: the loads
+      are in the invariant group (redundant ones are removed), and
+      the range tells the bounds checks that it isn't negative.
+    */
+    llvm::Value* getArrayLength(llvm::Value* array) {
+      auto arrayTy = (llvm::StructType*)array->getType()->getContainedType(0);
+
+      auto lengthAddr = builder->CreateStructGEP(arrayTy, array, ARRAY_LENGTH_INDEX);
+      auto length = builder->CreateLoad(builder->getInt64Ty(), lengthAddr, "len");
+
+      length->setMetadata(llvm::LLVMContext::MD_invariant_group, llvm::MDNode::get(*ctx, {}));
+      length->setMetadata(llvm::LLVMContext::MD_range,
+                          llvm::MDBuilder(*ctx).createRange(llvm::APInt(64, 0), llvm::APInt::getSignedMaxValue(64)));
+
+      return length;
+    }
+
+    /*
+      Address of an array element, bounds checked: a single unsigned
+      compare (negative indices are large), the failure is a cold
+      noreturn call. Inside loops bounded by the length, the check is
+      implied by the loop condition and removed, which lets the loop
+      vectorize.
+    */
+    llvm::Value* getElementAddress(llvm::Value* array, llvm::Value* index) {
+      auto arrayTy = (llvm::StructType*)array->getType()->getContainedType(0);
+
+      index = castValue(index, builder->getInt64Ty());
+      auto length = getArrayLength(array);
+
+      auto inBoundsBlock = createBB("inbounds", fn);
+      auto outOfBoundsBlock = createBB("outofbounds");
+
+      builder->CreateCondBr(builder->CreateICmpULT(index, length), inBoundsBlock, outOfBoundsBlock,
+                            llvm::MDBuilder(*ctx).createBranchWeights(2000, 1));
+
+      // out of bounds: reported by the runtime
+      fn->getBasicBlockList().push_back(outOfBoundsBlock);
+      builder->SetInsertPoint(outOfBoundsBlock);
+      builder->CreateCall(module->getFunction("eva_array_index_error"), {index, length});
+      builder->CreateUnreachable();
+
+      builder->SetInsertPoint(inBoundsBlock);
+
+      return builder->CreateInBoundsGEP(arrayTy, array,
+                                        {builder->getInt32(0), builder->getInt32(ARRAY_ELEMENTS_INDEX), index});
+    }
+
+    /*
+      function calls
+      (<name> <args>)
+    */
+    llvm::Value* genCall(const Exp& exp) {
+      // pure functions with constant args: the result
+      if (auto value = constEvaluator.evaluateCall(exp, options.constEvalSteps / CONST_CALL_STEPS_RATIO)) {
+        return getConstant(*value);
+      }
+
+      // lifted lambdas
+      auto lifted = liftedBindings_.find(exp.list[0].slot);
+      if (lifted != liftedBindings_.end()) {
+        return genLiftedCall(lifted->second, exp);
+      }
+
+      auto callable = gen(exp.list[0]);
+
+      // raw function, closure or a functor (callable class)
+      auto callableTy = callable->getType()->getContainedType(0);
+
+      if (closureTypes_.count(callableTy)) {
+        return genClosureCall(callable, exp);
+      }
+
+      std::vector<llvm::Value*> args{};
+      auto argIdx = 0;
+
+      if (callableTy->isStructTy()) {
+        auto cls = (llvm::StructType*)callableTy;
+
+        std::string className{cls->getName().data()};
+
+        // push the functor as the fust `self` arg.
+        args.push_back(callable);
+        argIdx++;
+
+        // TODO: support inheritance - load method from the vTable
+        callable = module->getFunction(className + "___call__");
+      }
+
+      auto fn = (llvm::Function*)callable;
+
+      for (auto i = 1; i < exp.list.size(); i++, argIdx++) {
+        auto argValue = gen(exp.list[i]);
+
+        auto paramTy = fn->getArg(argIdx)->getType();
+
+        args.push_back(castValue(argValue, paramTy));
+      }
+
+      return createCall(fn->getFunctionType(), fn, args, exp);
+    }
+
+    /*
+      method calls
+      ((method <instance> <name>) <args>)
+    */
+    llvm::Value* genMethodCall(const Exp& exp) {
+      auto loadedMethod = (llvm::LoadInst*)gen(exp.list[0]);
+
+      auto fnTy = (llvm::FunctionType*)(loadedMethod->getPointerOperand()->getType()->getContainedType(0)->getContainedType(0));
+
+      std::vector<llvm::Value*> args{};
+
+      for (auto i = 1; i < exp.list.size(); i++) {
+        auto argValue = gen(exp.list[i]);
+
+        // we need to cast to param type to support sub-classes.
+        // we should be able to pass Point3D instance for the type.
+        // of the parent class Point:
+        auto paramTy = fnTy->getParamType(i - 1);
+
+        args.push_back(castValue(argValue, paramTy));
+      }
+
+      return createCall(fnTy, loadedMethod, args, exp);
+    }
+
+    /*
+      lambda calls through a closure: the function is the first
+      method of its vTable, the closure is passed first
+      (<closure> <args>)
+    */
+    llvm::Value* genClosureCall(llvm::Value* closure, const Exp& exp) {
+      auto closureTy = closure->getType()->getContainedType(0);
+
+      if (!closureTypes_.count(closureTy)) {
+        DIE << "[EvaLLVM]: Not a function" << std::endl;
+      }
+
+      auto closureCls = (llvm::StructType*)closureTy;
+
+      // the vTable of a closure never changes
+      auto vTableAddr = builder->CreateStructGEP(closureCls, closure, VTABLE_INDEX);
+      auto vTable = builder->CreateLoad(closureCls->getElementType(VTABLE_INDEX), vTableAddr, "vt");
+      vTable->setMetadata(llvm::LLVMContext::MD_invariant_group, llvm::MDNode::get(*ctx, {}));
+
+      auto vTableTy = (llvm::StructType*)closureCls->getElementType(VTABLE_INDEX)->getPointerElementType();
+      auto fnAddr = builder->CreateStructGEP(vTableTy, vTable, RESERVED_VTABLE_ENTRIES);
+      auto fnPtr = builder->CreateLoad(vTableTy->getElementType(RESERVED_VTABLE_ENTRIES), fnAddr);
+      fnPtr->setMetadata(llvm::LLVMContext::MD_invariant_load, llvm::MDNode::get(*ctx, {}));
+
+      auto fnTy = (llvm::FunctionType*)fnPtr->getType()->getPointerElementType();
+
+      std::vector<llvm::Value*> args{closure};
+
+      for (auto i = 1; i < exp.list.size(); i++) {
+        args.push_back(castValue(gen(exp.list[i]), fnTy->getParamType(i)));
+      }
+
+      return createCall(fnTy, fnPtr, args, exp);
+    }
+
+    /*
+      direct call of a lifted lambda: the captured values, then the args
+      (<lambda> <args>)
+    */
+    llvm::Value* genLiftedCall(const LambdaInfo& lambda, const Exp& exp) {
+      auto args = lambda.captures;
+
+      for (auto i = 1; i < exp.list.size(); i++) {
+        args.push_back(castValue(gen(exp.list[i]), lambda.fn->getArg(args.size())->getType()));
+      }
+
+      return createCall(lambda.fn->getFunctionType(), lambda.fn, args, exp);
+    }
+
+    /*
+      Creates a call, a tail call when the call is in tail position.
+
+      The call is marked musttail and returned right away when the
+      callee is a function of the recursive group (being compiled)
+      with the type of the caller, tail otherwise. With loopTailCalls,
+      the self tail calls re-assign the params and jump back to the
+      start of the body. Either way the current block is terminated,
+      and the enclosing forms skip the rest of it. The calls passing
+      the address of a stack instance (which dies with the caller)
+      stay plain calls.
+    */
+    llvm::Value* createCall(llvm::FunctionType* fnTy, llvm::Value* callee,
+                            const std::vector<llvm::Value*>& args, const Exp& exp) {
+      if (!tailCalls_.count(&exp) || passesStackMemory(args)) {
+        return builder->CreateCall(fnTy, callee, args);
+      }
+
+      // self tail call: parallel assignment of the params
+      if (callee == fn && options.loopTailCalls) {
+        auto param = fn->arg_begin();
+
+        for (auto arg : args) {
+          builder->CreateStore(arg, tailParams_[param++->getArgNo()]);
+        }
+
+        auto tailRecurseBlock = getTailRecurseBlock();
+        builder->CreateBr(tailRecurseBlock);
+
+        return llvm::UndefValue::get(fn->getReturnType());
+      }
+
+      auto call = builder->CreateCall(fnTy, callee, args);
+
+      // indirect calls and calls out of the group may not match
+      // the caller's prototype; statepoints can't be musttail calls
+      auto direct = llvm::dyn_cast<llvm::Function>(callee);
+
+      if (direct == nullptr || !recursiveGroup_.count(direct) || fnTy != fn->getFunctionType() ||
+          options.preciseGC) {
+        call->setTailCallKind(llvm::CallInst::TCK_Tail);
+        return call;
+      }
+
+      call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+      builder->CreateRet(call);
+
+      return call;
+    }
+
+    /*
+      Start of the body of the current function, the target of the
+      self tail calls: split off the prologue on the first one.
+    */
+    llvm::BasicBlock* getTailRecurseBlock() {
+      if (tailRecurseBlock_ != nullptr) {
+        return tailRecurseBlock_;
+      }
+
+      auto& entry = fn->getEntryBlock();
+
+      // the allocas stay in the entry block
+      auto it = tailRecurseFrom_ == nullptr ? entry.begin() : ++tailRecurseFrom_->getIterator();
+      while (it != entry.end() && llvm::isa<llvm::AllocaInst>(*it)) {
+        it++;
+      }
+
+      // the entry block may not be terminated yet: moved by hand
+      tailRecurseBlock_ = llvm::BasicBlock::Create(*ctx, "tailrecurse", fn, entry.getNextNode());
+      tailRecurseBlock_->getInstList().splice(tailRecurseBlock_->end(), entry.getInstList(), it, entry.end());
+      tailRecurseBlock_->replaceSuccessorsPhiUsesWith(&entry, tailRecurseBlock_);
+      llvm::BranchInst::Create(tailRecurseBlock_, &entry);
+
+      if (builder->GetInsertBlock() == &entry) {
+        builder->SetInsertPoint(tailRecurseBlock_);
+      }
+
+      return tailRecurseBlock_;
+    }
+
+    /*
+      Whether the current block is terminated already:
+      by a tail call, the rest of the block is dead.
+    */
+    bool blockTerminated() {
+      return builder->GetInsertBlock()->getTerminator() != nullptr;
+    }
+
+    /*
+      Whether one of the args points into the stack frame.
+    */
+    bool passesStackMemory(const std::vector<llvm::Value*>& args) {
+      for (auto arg : args) {
+        if (arg->getType()->isPointerTy() && llvm::isa<llvm::AllocaInst>(llvm::getUnderlyingObject(arg))) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /*
+      Collects the calls in tail position of a function body:
+      the body, the last expression of a block and the branches
+      of an if in tail position.
+    */
+    void collectTailCalls(const Exp& exp) {
+      if (exp.type != ExpType::LIST || exp.list.empty()) {
+        return;
+      }
+
+      const auto& tag = exp.list[0];
+
+      // method calls
+      if (tag.type != ExpType::SYMBOL) {
+        tailCalls_.insert(&exp);
+        return;
+      }
+
+      // function calls
+      if (tag.id >= KEYWORDS_COUNT || specialForms_[tag.id] == nullptr) {
+        tailCalls_.insert(&exp);
+        return;
+      }
+
+      if (tag.id == KW_BEGIN && exp.list.size() > 1) {
+        collectTailCalls(exp.list[exp.list.size() - 1]);
+      }
+      else if (tag.id == KW_IF) {
+        collectTailCalls(exp.list[2]);
+        collectTailCalls(exp.list[3]);
+      }
+    }
+
+    /*
+      Returns field index.
+    */
+    size_t getFieldIndex(llvm::StructType* cls, SymbolId fieldName) {
+      auto classInfo = getClassInfo(cls);
+      auto it = classInfo->fieldSlots.find(fieldName);
+
+      if (it == classInfo->fieldSlots.end()) {
+        DIE << "[EvaLLVM]: Unknown field " << SymbolTable::global().name(fieldName)
+            << " in class " << cls->getName().str() << std::endl;
+      }
+
+      return it->second;
+    }
+
+    /*
+      Returns method index.
+    */
+    size_t getMethodIndex(llvm::StructType* cls, SymbolId methodName) {
+      auto classInfo = getClassInfo(cls);
+      auto it = classInfo->methodSlots.find(methodName);
+
+      if (it == classInfo->methodSlots.end()) {
+        DIE << "[EvaLLVM]: Unknown method " << SymbolTable::global().name(methodName)
+            << " in class " << cls->getName().str() << std::endl;
+      }
+
+      return it->second;
+    }
+
+    /*
+      Creates an instance of a class.
+    */
+    llvm::Value* createInstance(const Exp& exp, const std::string& name) {
+      auto className = std::string(exp.list[1].string());
+      auto cls = getClassByName(className);
+
+      if (cls == nullptr) {
+        DIE << "[EvaLLVM]: Unknown class " << cls;
+      }
+
+      // instances which don't outlive the function are allocated on
+      // the stack, the others with malloc here as an external function
+      // to reuse memory allocation a garbage collection
+      auto instance = options.stackAllocate && !escapeAnalysis.escapes(exp)
+        ? allocaInstance(cls, name)
+        : mallocInstance(cls, name);
+
+      // call constructor after instance has been created
+      auto ctor = module->getFunction(className + "_constructor");
+
+      std::vector<llvm::Value*> args{instance};
+
+      for (auto i = 2; i < exp.list.size(); i++) {
+        args.push_back(castValue(gen(exp.list[i]), ctor->getArg(i - 1)->getType()));
+      }
+
+      builder->CreateCall(ctor, args);
+
+      return instance;
+    }
+
+    /*
+      Allocates an object of given class on the heap.
+    */
+    llvm::Value* mallocInstance(llvm::StructType* cls, const std::string& name) {
+      std::string className{cls->getName().data()};
+
+      // will give us a void*, allocated with the
+      // descriptor of the class for the collector.
+      // the precise collector always has the young generation
+      auto mallocPtr = options.preciseGC || (options.inlineAllocation && getTypeSize(cls) <= EVA_NURSERY_MAX_OBJECT_SIZE)
+        ? nurseryAlloc(cls, name)
+        : builder->CreateCall(module->getFunction("eva_alloc_class"),
+                              module->getNamedGlobal(className + "_descriptor"), name);
+
+      // need to convert pointer to our class pointer type
+      // void* -> Point*
+      auto instance = builder->CreatePointerCast(mallocPtr, getClassPointerType(cls));
+
+      installVTable(cls, instance);
+
+      return instance;
+    }
+
+    /*
+      Bump-allocates from the thread-local nursery of the class
+      (runtime/EvaRuntime.h), or from the young generation of the
+      precise collector (runtime/EvaGC.h): the fast path is inline,
+      the runtime is only called when the nursery is full.
+    */
+    llvm::Value* nurseryAlloc(llvm::StructType* cls, const std::string& name) {
+      std::string className{cls->getName().data()};
+
+      auto nursery = module->getNamedGlobal(options.preciseGC ? "eva_gc_young" : className + "_nursery");
+      auto nurseryTy = (llvm::StructType*)nursery->getValueType();
+      auto bytePtrTy = nurseryTy->getElementType(0);
+      auto descriptor = module->getNamedGlobal(className + "_descriptor");
+
+      auto cursorAddr = builder->CreateStructGEP(nurseryTy, nursery, 0);
+      auto limitAddr = builder->CreateStructGEP(nurseryTy, nursery, 1);
+
+      // the objects of a class nursery are `stride` bytes apart, the
+      // collector's size for them (the young generation is packed)
+      auto stride = options.preciseGC
+        ? (llvm::Value*)builder->getInt64(getObjectSize(cls))
+        : builder->CreateLoad(builder->getInt64Ty(), builder->CreateStructGEP(nurseryTy, nursery, 2), "stride");
+
+      // the cursor is null before the first refill: not inbounds
+      auto cursor = builder->CreateLoad(bytePtrTy, cursorAddr, "cursor");
+      auto next = builder->CreateGEP(builder->getInt8Ty(), cursor, stride);
+      auto limit = builder->CreateLoad(bytePtrTy, limitAddr, "limit");
+      auto fits = builder->CreateICmpULE(next, limit);
+
+      auto fastBlock = createBB("alloc", fn);
+      auto slowBlock = createBB("alloc.slow");
+      auto doneBlock = createBB("alloc.done");
+
+      builder->CreateCondBr(fits, fastBlock, slowBlock, llvm::MDBuilder(*ctx).createBranchWeights(2000, 1));
+
+      // fast path: bump the cursor
+      builder->SetInsertPoint(fastBlock);
+      builder->CreateStore(next, cursorAddr);
+      builder->CreateBr(doneBlock);
+
+      // slow path: refill, or collect the young generation
+      fn->getBasicBlockList().push_back(slowBlock);
+      builder->SetInsertPoint(slowBlock);
+      auto object = options.preciseGC
+        ? builder->CreateCall(module->getFunction("eva_gc_alloc_slow"), descriptor)
+        : builder->CreateCall(module->getFunction("eva_alloc_class_slow"), {nursery, descriptor});
+      builder->CreateBr(doneBlock);
+
+      fn->getBasicBlockList().push_back(doneBlock);
+      builder->SetInsertPoint(doneBlock);
+
+      auto memory = builder->CreatePHI(bytePtrTy, 2, name);
+      memory->addIncoming(cursor, fastBlock);
+      memory->addIncoming(object, slowBlock);
+
+      return memory;
+    }
+
+    /*
+      Allocates an object of given class on the stack, in the
+      entry block: one slot per (new ...), reused by loops.
+    */
+    llvm::Value* allocaInstance(llvm::StructType* cls, const std::string& name) {
+      auto instance = createEntryAlloca(cls, name);
+
+      installVTable(cls, instance);
+
+      return instance;
+    }
+
+    /*
+      Installs the vTable to lookup methods.
+    */
+    void installVTable(llvm::StructType* cls, llvm::Value* instance) {
+      std::string className{cls->getName().data()};
+      auto vTableName = className + "_vTable";
+      auto vTableAddr = builder->CreateStructGEP(cls, instance, VTABLE_INDEX);
+      auto vTable = module->getNamedGlobal(vTableName);
+      auto vTableStore = builder->CreateStore(vTable, vTableAddr);
+      vTableStore->setMetadata(llvm::LLVMContext::MD_invariant_group, llvm::MDNode::get(*ctx, {}));
+    }
+
+    /*
+      Size of the objects of a class in the heap.
+    */
+    uint64_t getObjectSize(llvm::StructType* cls) {
+      return llvm::alignTo(getTypeSize(cls), EVA_OBJECT_ALIGNMENT);
+    }
+
+    /*
+      Returns size of a type in bytes.
+    */
+    size_t getTypeSize(llvm::Type* type_) {
+      return module->getDataLayout().getTypeAllocSize(type_);
+    }
+
+    /*
+      Inherits parent class fields.
+    */
+    void inheritClass(llvm::StructType* cls, llvm::StructType* parent) {
+      auto parentClassInfo = getClassInfo(parent);
+
+      // inherit the fields and methods, in the same slots,
+      // so the class layout and vTable extend the parent's.
+      *getClassInfo(cls) = {
         /* class */ cls,
         /* parent */ parent,
-        /* fields */ parentClassInfo->fieldsMap,
-        /* methods */ parentClassInfo->methodsMap};
+        /* fields */ parentClassInfo->fields,
+        /* methods */ parentClassInfo->methods,
+        /* field slots */ parentClassInfo->fieldSlots,
+        /* method slots */ parentClassInfo->methodSlots};
 
     }
 
     /*
       Extract fields and methods from a class expression.
     */
-    void buildClassInfo(llvm::StructType* cls, const Exp& clsExp, Env env) {
-      auto className = clsExp.list[1].string;
-      auto classInfo = &classMap_[className];
+    void buildClassInfo(llvm::StructType* cls, const Exp& clsExp) {
+      auto className = std::string(clsExp.list[1].string());
+      auto classInfo = &classMap_[clsExp.list[1].id];
 
       // body block
-      auto body = clsExp.list[3];
-      
+      const auto& body = clsExp.list[3];
+
+      // fields declared in this class
+      std::vector<std::pair<SymbolId, llvm::Type*>> ownFields;
+
       // iterate over the statements in the body block
       for (auto i = 1; i < body.list.size(); i++) {
-        auto exp = body.list[i];
+        const auto& exp = body.list[i];
 
         // check if it is a variable assignment statement
         if (isVar(exp)) {
 
-          auto varNameDecl = exp.list[1];
+          const auto& varNameDecl = exp.list[1];
 
-          auto fieldName = extractVarName(varNameDecl); // get name of the variable
+          auto fieldName = extractVarId(varNameDecl); // get name of the variable
           auto fieldTy = extractVarType(varNameDecl); // get variable type
 
-          classInfo->fieldsMap[fieldName] = fieldTy; // add the field into the class's field map
-        } 
+          auto it = classInfo->fieldSlots.find(fieldName);
+
+          // redeclared inherited field: keeps its slot
+          if (it != classInfo->fieldSlots.end()) {
+            classInfo->fields[it->second - RESERVED_FIELDS_COUNT].second = fieldTy;
+          } else {
+            ownFields.emplace_back(fieldName, fieldTy);
+          }
+        }
         
         // check if it is a method declaration
         else if (isDef(exp)) {
-          auto methodName = exp.list[1].string; // get the method name
+          auto methodName = std::string(exp.list[1].string()); // get the method name
           auto fnName = className + "_" + methodName; // to maintain uniqueness across classes use cls name + fn name
 
           // add the method definition into the classes method map
-          classInfo->methodsMap[methodName] = createFunctionProto(fnName, extractFunctionType(exp), env);
+          auto method = createFunctionProto(fnName, extractFunctionType(exp));
+          auto methodId = exp.list[1].id;
+
+          auto it = classInfo->methodSlots.find(methodId);
+
+          // overrides take the parent's vTable slot, new methods are appended
+          if (it != classInfo->methodSlots.end()) {
+            classInfo->methods[it->second - RESERVED_VTABLE_ENTRIES].second = method;
+          } else {
+            classInfo->methodSlots[methodId] = classInfo->methods.size() + RESERVED_VTABLE_ENTRIES;
+            classInfo->methods.emplace_back(methodId, method);
+          }
+
+          // methods are visible as <class>_<method>
+          bindings_[exp.list[1].slot] = method;
         }
       }
       
+      // own fields go after the inherited ones
+      if (options.optimizeLayout) {
+        orderFields(cls, className, ownFields);
+      }
+
+      for (auto& field : ownFields) {
+        classInfo->fieldSlots[field.first] = classInfo->fields.size() + RESERVED_FIELDS_COUNT;
+        classInfo->fields.push_back(field);
+      }
+
       // create fields.
       buildClassBody(cls);
     }
 
-    /*
-      Builds class body using class info.
-    */
-    void buildClassBody(llvm::StructType* cls) {
-      std::string className{cls->getName().data()};
+    /*
+      Orders the fields declared in a class (inherited ones keep
+      their place, so the layout stays a prefix extension of the
+      parent's). Profiled hot fields come first, as many as fit in
+      the cache line of the vTable pointer, by decreasing access
+      count; then both groups are sorted by decreasing alignment,
+      which removes the padding between fields.
+    */
+    void orderFields(llvm::StructType* cls, const std::string& className,
+                     std::vector<std::pair<SymbolId, llvm::Type*>>& fields) {
+      auto& dataLayout = module->getDataLayout();
+
+      auto heat = [&](SymbolId field) -> uint64_t {
+        auto key = className + "." + std::string(SymbolTable::global().name(field));
+        auto it = options.fieldProfile.find(key);
+        return it == options.fieldProfile.end() ? 0 : it->second;
+      };
+
+      auto byHeat = [&](const auto& a, const auto& b) { return heat(a.first) > heat(b.first); };
+      auto byAlign = [&](const auto& a, const auto& b) {
+        return dataLayout.getABITypeAlign(a.second) > dataLayout.getABITypeAlign(b.second);
+      };
+
+      std::stable_sort(fields.begin(), fields.end(), byHeat);
+
+      // the object header: vTable pointer and inherited fields
+      auto parent = getClassInfo(cls)->parent;
+      uint64_t offset = parent != nullptr
+        ? dataLayout.getTypeStoreSize(parent)
+        : dataLayout.getPointerSize();
+
+      auto hotEnd = fields.begin();
+      while (hotEnd != fields.end() && heat(hotEnd->first) > 0) {
+        auto size = dataLayout.getTypeAllocSize(hotEnd->second);
+        if (offset + size > CACHE_LINE_SIZE) {
+          break;
+        }
+        offset += size;
+        hotEnd++;
+      }
+
+      std::stable_sort(fields.begin(), hotEnd, byAlign);
+      std::stable_sort(hotEnd, fields.end(), byAlign);
+    }
+
+    /*
+      Builds class body using class info.
+    */
+    void buildClassBody(llvm::StructType* cls) {
+      std::string className{cls->getName().data()};
+
+      auto classInfo = getClassInfo(cls);
+
+      // allocate vTable to set its type in the body.
+      // the table itself is populated later in buildVTable.
+      auto vTableName = className + "_vTable";
+      auto vTableTy = llvm::StructType::create(*ctx, vTableName);
+
+      auto clsFields = std::vector<llvm::Type*>{
+        // first element is always the vTable.
+        vTableTy->getPointerTo(),
+      };
+
+      // field types
+      for (const auto& fieldInfo : classInfo->fields) {
+        clsFields.push_back(fieldInfo.second);
+      }
+
+      cls->setBody(clsFields, /* packed */ false);
+
+      // layout for the collector
+      buildClassDescriptor(cls);
+
+      // methods:
+      buildVTable(cls);
+    }
+
+    /*
+      Emits the descriptor of the class for the collector (see
+      runtime/EvaRuntime.h): the object size, and the bitmap of the
+      words which point to the heap, the instance and string fields
+      (not the vTable). Also the nursery the class is allocated from.
+    */
+    void buildClassDescriptor(llvm::StructType* cls) {
+      std::string className{cls->getName().data()};
+
+      auto layout = module->getDataLayout().getStructLayout(cls);
+      auto words = getObjectSize(cls) / 8;
+
+      std::vector<uint64_t> pointers((words + 63) / 64, 0);
+
+      for (auto i = RESERVED_FIELDS_COUNT; i < cls->getNumElements(); i++) {
+        if (cls->getElementType(i)->isPointerTy()) {
+          auto word = layout->getElementOffset(i) / 8;
+          pointers[word / 64] |= 1ull << (word % 64);
+        }
+      }
+
+      auto bitmap = new llvm::GlobalVariable(*module, llvm::ArrayType::get(builder->getInt64Ty(), pointers.size()),
+                                             /* constant */ true, llvm::GlobalValue::InternalLinkage,
+                                             llvm::ConstantDataArray::get(*ctx, pointers),
+                                             className + "_pointers");
+
+      auto descriptorTy = llvm::StructType::getTypeByName(*ctx, "EvaClassDescriptor");
+
+      auto descriptor = llvm::ConstantStruct::get(descriptorTy, {
+        builder->getInt64(getObjectSize(cls)),
+        llvm::ConstantExpr::getInBoundsGetElementPtr(bitmap->getValueType(), bitmap,
+                                                     llvm::ArrayRef<llvm::Constant*>{builder->getInt32(0), builder->getInt32(0)}),
+        /* collector descriptor */ builder->getInt64(0),
+        builder->getInt64(0),
+        /* not an array */ builder->getInt64(0),
+        builder->getInt64(0),
+        /* collector kind */ builder->getInt64(0),
+      });
+
+      // the collector descriptor is set by the runtime
+      new llvm::GlobalVariable(*module, descriptorTy, /* constant */ false,
+                               llvm::GlobalValue::InternalLinkage, descriptor,
+                               className + "_descriptor");
+
+      if (options.inlineAllocation && !options.preciseGC) {
+        auto nurseryTy = llvm::StructType::getTypeByName(*ctx, "EvaNursery");
+
+        // empty: the first allocation calls the runtime
+        auto bytePtrTy = (llvm::PointerType*)nurseryTy->getElementType(0);
+        auto nursery = llvm::ConstantStruct::get(nurseryTy, {
+          llvm::ConstantPointerNull::get(bytePtrTy),
+          llvm::ConstantPointerNull::get(bytePtrTy),
+          /* stride */ builder->getInt64(getObjectSize(cls)),
+          llvm::ConstantPointerNull::get(bytePtrTy),
+          builder->getInt64(0),
+          builder->getInt64(0),
+          builder->getInt64(0),
+          builder->getInt64(0),
+        });
+
+        new llvm::GlobalVariable(*module, nurseryTy, /* constant */ false,
+                                 llvm::GlobalValue::InternalLinkage, nursery,
+                                 className + "_nursery", /* insert before */ nullptr,
+                                 llvm::GlobalValue::LocalExecTLSModel);
+      }
+    }
+
+    /*
+      create a vTable per class.
+      vTable stores method references 
+      to support inheritance and method overloading.
+    */
+    void buildVTable(llvm::StructType* cls) {
+      std::string className{cls->getName().data()}; // get the class name
+      auto vTableName = className + "_vTable"; // set the vTable name for the class
+
+      // the vTable should already exists.
+      auto vTableTy = llvm::StructType::getTypeByName(*ctx, vTableName);
+
+      // the class descriptor, then the methods
+      auto descriptor = module->getNamedGlobal(className + "_descriptor");
+
+      std::vector<llvm::Constant*> vTableMethods{descriptor};
+      std::vector<llvm::Type*> vTableMethodTys{descriptor->getType()};
+
+      // iterate over the methods in a class and collect methods and method types
+      for (auto& methodInfo : getClassInfo(cls)->methods) {
+        auto method = methodInfo.second;
+        vTableMethods.push_back(method);
+        vTableMethodTys.push_back(method->getType());
+      }
+
+      vTableTy->setBody(vTableMethodTys);
+
+      auto vTableValue = llvm::ConstantStruct::get(vTableTy, vTableMethods);
+
+      // vTables are read-only and not visible outside the program
+      auto vTable = new llvm::GlobalVariable(*module, vTableTy, /* constant */ true,
+                                             llvm::GlobalValue::InternalLinkage,
+                                             vTableValue, vTableName);
+
+      // a class vTable is also a valid vTable of all its ancestors
+      // (same slots), at offset 0: the !type metadata for devirtualization
+      for (auto ancestor = cls; ancestor != nullptr; ancestor = getClassInfo(ancestor)->parent) {
+        vTable->addTypeMetadata(0, getTypeId(ancestor));
+      }
+
+      vTable->setVCallVisibilityMetadata(llvm::GlobalObject::VCallVisibilityTranslationUnit);
+    }
+
+    /*
+      Type identifier of a class for the !type metadata.
+    */
+    llvm::MDString* getTypeId(llvm::StructType* cls) {
+      return llvm::MDString::get(*ctx, cls->getName());
+    }
+
+    /*
+      Returns the array type of an element type, created on first
+      use with its descriptor and vTable: Array_<element type>
+      { vTable, i64 length, [0 x <element type>] }
+    */
+    llvm::StructType* getArrayType(llvm::Type* elementTy) {
+      auto& arrayTy = arrayTypes_[elementTy];
+
+      if (arrayTy != nullptr) {
+        return arrayTy;
+      }
+
+      auto arrayName = "Array_" + getTypeName(elementTy);
+      auto vTableTy = llvm::StructType::getTypeByName(*ctx, "EvaArray_vTable");
+
+      arrayTy = llvm::StructType::create(*ctx, {vTableTy->getPointerTo(), builder->getInt64Ty(),
+                                                llvm::ArrayType::get(elementTy, 0)},
+                                         arrayName);
+
+      // header size, and the element layout
+      auto descriptorTy = llvm::StructType::getTypeByName(*ctx, "EvaClassDescriptor");
+      auto noPointers = new llvm::GlobalVariable(*module, llvm::ArrayType::get(builder->getInt64Ty(), 1),
+                                                 /* constant */ true, llvm::GlobalValue::InternalLinkage,
+                                                 llvm::ConstantDataArray::get(*ctx, llvm::ArrayRef<uint64_t>{0}),
+                                                 arrayName + "_pointers");
+
+      auto descriptor = llvm::ConstantStruct::get(descriptorTy, {
+        builder->getInt64(module->getDataLayout().getStructLayout(arrayTy)->getElementOffset(ARRAY_ELEMENTS_INDEX)),
+        llvm::ConstantExpr::getInBoundsGetElementPtr(noPointers->getValueType(), noPointers,
+                                                     llvm::ArrayRef<llvm::Constant*>{builder->getInt32(0), builder->getInt32(0)}),
+        /* collector descriptor */ builder->getInt64(0),
+        builder->getInt64(0),
+        builder->getInt64(getTypeSize(elementTy)),
+        builder->getInt64(elementTy->isPointerTy()),
+        /* collector kind */ builder->getInt64(0),
+      });
+
+      auto descriptorVar = new llvm::GlobalVariable(*module, descriptorTy, /* constant */ false,
+                                                    llvm::GlobalValue::InternalLinkage, descriptor,
+                                                    arrayName + "_descriptor");
+
+      new llvm::GlobalVariable(*module, vTableTy, /* constant */ true, llvm::GlobalValue::InternalLinkage,
+                               llvm::ConstantStruct::get(vTableTy, {descriptorVar}), arrayName + "_vTable");
+
+      return arrayTy;
+    }
+
+    /*
+      Returns the closure type of a signature, created on first use:
+      Fn_<return type>_<param types> { vTable }, the vTable holds the
+      descriptor and the function, which takes the closure first.
+    */
+    llvm::StructType* getClosureType(llvm::Type* returnType, const std::vector<llvm::Type*>& paramTypes) {
+      auto& closureTy = closureSignatures_[llvm::FunctionType::get(returnType, paramTypes, /* varargs */ false)];
+
+      if (closureTy != nullptr) {
+        return closureTy;
+      }
+
+      auto closureName = "Fn_" + getTypeName(returnType);
+      for (auto paramTy : paramTypes) {
+        closureName += "_" + getTypeName(paramTy);
+      }
+
+      closureTy = llvm::StructType::create(*ctx, closureName);
+      closureTypes_.insert(closureTy);
+
+      std::vector<llvm::Type*> fnParamTypes{getClassPointerType(closureTy)};
+      fnParamTypes.insert(fnParamTypes.end(), paramTypes.begin(), paramTypes.end());
+
+      auto descriptorTy = llvm::StructType::getTypeByName(*ctx, "EvaClassDescriptor");
+      auto vTableTy = llvm::StructType::create(*ctx, {descriptorTy->getPointerTo(),
+                                                      llvm::FunctionType::get(returnType, fnParamTypes, false)->getPointerTo()},
+                                               closureName + "_vTable");
+
+      closureTy->setBody({vTableTy->getPointerTo()});
+
+      return closureTy;
+    }
+
+    /*
+      Creates a closure of a lambda: an instance of its environment
+      class, as the closure type of its signature.
+    */
+    llvm::Value* createClosure(const LambdaInfo& lambda, bool onStack) {
+      auto env = getEnvironmentClass(lambda);
+
+      auto instance = onStack ? allocaInstance(env, "env") : mallocInstance(env, "env");
+
+      for (auto i = 0; i < lambda.captures.size(); i++) {
+        auto address = builder->CreateStructGEP(env, instance, i + RESERVED_FIELDS_COUNT);
+        builder->CreateStore(lambda.captures[i], address);
+      }
+
+      auto vTableTy = env->getElementType(VTABLE_INDEX)->getPointerElementType();
+      auto closureTy = closureVTables_[vTableTy];
+
+      return builder->CreatePointerCast(instance, getClassPointerType(closureTy));
+    }
+
+    /*
+      Returns the environment class of a lambda, created on first use:
+      <lambda> { vTable, <captured values>... }, with its descriptor and
+      its vTable, which holds <lambda>___call__: loads the captured
+      values and calls the lifted lambda.
+    */
+    llvm::StructType* getEnvironmentClass(const LambdaInfo& lambda) {
+      auto& env = environments_[lambda.fn];
+
+      if (env != nullptr) {
+        return env;
+      }
+
+      std::string lambdaName{lambda.fn->getName().data()};
+      auto captures = lambda.captures.size();
+
+      // the signature, without the captured values
+      std::vector<llvm::Type*> paramTypes;
+      for (auto i = captures; i < lambda.fn->arg_size(); i++) {
+        paramTypes.push_back(lambda.fn->getArg(i)->getType());
+      }
+
+      auto closureTy = getClosureType(lambda.fn->getReturnType(), paramTypes);
+      auto vTableTy = (llvm::StructType*)closureTy->getElementType(VTABLE_INDEX)->getPointerElementType();
+      closureVTables_[vTableTy] = closureTy;
+
+      std::vector<llvm::Type*> fields{vTableTy->getPointerTo()};
+      for (auto value : lambda.captures) {
+        fields.push_back(value->getType());
+      }
+
+      env = llvm::StructType::create(*ctx, fields, lambdaName);
 
-      auto classInfo = &classMap_[className];
+      // layout for the collector
+      buildClassDescriptor(env);
 
-      // allocate vTable to set its type in the body.
-      // the table itself is populated later in buildVTable.
-      auto vTableName = className + "_vTable";
-      auto vTableTy = llvm::StructType::create(*ctx, vTableName);
+      // the closure function
+      auto callTy = (llvm::FunctionType*)vTableTy->getElementType(RESERVED_VTABLE_ENTRIES)->getPointerElementType();
+      auto call = createFunctionProto(lambdaName + "___call__", callTy);
 
-      auto clsFields = std::vector<llvm::Type*>{
-        // first element is always the vTable.
-        vTableTy->getPointerTo(),
-      };
+      auto prevBlock = builder->GetInsertBlock();
+      builder->SetInsertPoint(createBB("entry", call));
 
-      // field types
-      for (const auto& fieldInfo : classInfo->fieldsMap) {
-        clsFields.push_back(fieldInfo.second);
+      auto self = builder->CreatePointerCast(call->getArg(0), getClassPointerType(env));
+
+      std::vector<llvm::Value*> args;
+      for (auto i = 0; i < captures; i++) {
+        auto address = builder->CreateStructGEP(env, self, i + RESERVED_FIELDS_COUNT);
+        args.push_back(builder->CreateLoad(fields[i + RESERVED_FIELDS_COUNT], address));
+      }
+      for (auto i = 1; i < call->arg_size(); i++) {
+        args.push_back(call->getArg(i));
       }
 
-      cls->setBody(clsFields, /* packed */ false);
+      auto result = builder->CreateCall(lambda.fn, args);
+      result->setTailCall();
+      builder->CreateRet(result);
 
-      // methods:
-      buildVTable(cls);
+      builder->SetInsertPoint(prevBlock);
+
+      auto descriptor = module->getNamedGlobal(lambdaName + "_descriptor");
+
+      new llvm::GlobalVariable(*module, vTableTy, /* constant */ true, llvm::GlobalValue::InternalLinkage,
+                               llvm::ConstantStruct::get(vTableTy, {descriptor, call}), lambdaName + "_vTable");
+
+      return env;
     }
 
     /*
-      create a vTable per class.
-      vTable stores method references 
-      to support inheritance and method overloading.
+      Element type of an array type.
     */
-    void buildVTable(llvm::StructType* cls) {
-      std::string className{cls->getName().data()}; // get the class name
-      auto vTableName = className + "_vTable"; // set the vTable name for the class
-
-      // the vTable should already exists.
-      auto vTableTy = llvm::StructType::getTypeByName(*ctx, vTableName);
-
-      // create vTable methods and method types
-      std::vector<llvm::Constant*> vTableMethods;
-      std::vector<llvm::Type*> vTableMethodTys;
+    llvm::Type* getElementType(llvm::StructType* arrayTy) {
+      return arrayTy->getElementType(ARRAY_ELEMENTS_INDEX)->getArrayElementType();
+    }
 
-      // iterate over the methods in a class and collect methods and method types
-      for (auto& methodInfo : classMap_[className].methodsMap) {
-        auto method = methodInfo.second;
-        vTableMethods.push_back(method);
-        vTableMethodTys.push_back(method->getType());
+    /*
+      Eva name of a type: i32, i64, f64, string, or the class name.
+    */
+    std::string getTypeName(llvm::Type* type_) {
+      if (type_->isIntegerTy()) {
+        return "i" + std::to_string(type_->getIntegerBitWidth());
       }
 
-      vTableTy->setBody(vTableMethodTys);
+      if (type_->isDoubleTy()) {
+        return "f64";
+      }
 
-      auto vTableValue = llvm::ConstantStruct::get(vTableTy, vTableMethods);
-      createGlobalVar(vTableName, vTableValue);
+      auto pointee = type_->getPointerElementType();
+      return pointee->isStructTy() ? pointee->getStructName().str() : "string";
     }
 
 
     /*
       Tagged list
     */
-    bool isTaggedList(const Exp& exp, const std::string& tag) {
+    bool isTaggedList(const Exp& exp, SymbolId tag) {
       return exp.type == ExpType::LIST && exp.list[0].type == ExpType::SYMBOL && 
-              exp.list[0].string == tag;
+              exp.list[0].id == tag;
     }
 
     /*
       to check if list is of variable assignment type.
       (var ...)
     */
-    bool isVar(const Exp& exp) { return isTaggedList(exp, "var"); }
+    bool isVar(const Exp& exp) { return isTaggedList(exp, KW_VAR); }
 
     /*
       to check if list is of variable assignment type.
       (def ...)
     */
-    bool isDef(const Exp& exp) { return isTaggedList(exp, "def"); }
+    bool isDef(const Exp& exp) { return isTaggedList(exp, KW_DEF); }
 
     /*
       to check if list is of object instantiation type.
       (new ...)
     */
-    bool isNew(const Exp& exp) { return isTaggedList(exp, "new"); }
+    bool isNew(const Exp& exp) { return isTaggedList(exp, KW_NEW); }
 
     /*
       to check if the list is of object
       (prop ...)
     */
-    bool isProp(const Exp& exp) { return isTaggedList(exp, "prop"); }
+    bool isProp(const Exp& exp) { return isTaggedList(exp, KW_PROP); }
 
     /*
       (super ...)
     */
-    bool isSuper(const Exp& exp) { return isTaggedList(exp, "super"); }
+    bool isSuper(const Exp& exp) { return isTaggedList(exp, KW_SUPER); }
+
+    /*
+      Returns class info of a class type.
+    */
+    ClassInfo* getClassInfo(llvm::StructType* cls) {
+      auto& classInfo = classInfos_[cls];
+
+      if (classInfo == nullptr) {
+        classInfo = &classMap_[intern(std::string_view(cls->getName().data(), cls->getName().size()))];
+      }
+
+      return classInfo;
+    }
 
     /*
       Get a type struct using name.
@@ -801,7 +2291,22 @@ class EvaLLVM {
       (var (x number) 10) -> x
     */
     std::string extractVarName(const Exp& exp) {
-      return exp.type == ExpType::LIST ? exp.list[0].string : exp.string;
+      return std::string(exp.type == ExpType::LIST ? exp.list[0].string() : exp.string());
+    }
+
+    /*
+      Extract the interned variable/param name.
+    */
+    SymbolId extractVarId(const Exp& exp) {
+      return exp.type == ExpType::LIST ? exp.list[0].id : exp.id;
+    }
+
+    /*
+      Binding slot of a variable/param declaration,
+      assigned by the resolver.
+    */
+    uint32_t extractVarSlot(const Exp& exp) {
+      return exp.type == ExpType::LIST ? exp.list[0].slot : exp.slot;
     }
 
     /*
@@ -810,54 +2315,99 @@ class EvaLLVM {
       (x number) -> number
     */
     llvm::Type* extractVarType(const Exp& exp) {
-      return exp.type == ExpType::LIST ? getTypeFromString(exp.list[1].string) : builder->getInt32Ty();
+      return exp.type == ExpType::LIST ? getTypeFromExp(exp.list[1]) : builder->getInt32Ty();
+    }
+
+    /*
+      Infer the LLVM type from a type expression: a type name,
+      (array <type>) or (fn <return type> <param types>...)
+    */
+    llvm::Type* getTypeFromExp(const Exp& type_) {
+      if (isTaggedList(type_, KW_ARRAY)) {
+        return getClassPointerType(getArrayType(getTypeFromExp(type_.list[1])));
+      }
+
+      if (isTaggedList(type_, KW_FN)) {
+        std::vector<llvm::Type*> paramTypes;
+        for (auto i = 2; i < type_.list.size(); i++) {
+          paramTypes.push_back(getTypeFromExp(type_.list[i]));
+        }
+        return getClassPointerType(getClosureType(getTypeFromExp(type_.list[1]), paramTypes));
+      }
+
+      return getTypeFromSymbol(type_.id);
     }
 
     /*
-      Infer the LLVM type from the string representation
+      Infer the LLVM type from the type name symbol
     */
-    llvm::Type* getTypeFromString(const std::string& type_) {
-      // number -> i32
-      if (type_ == "number") {
+    llvm::Type* getTypeFromSymbol(SymbolId type_) {
+      // number, i32 -> i32
+      if (type_ == KW_NUMBER || type_ == KW_I32) {
         return builder->getInt32Ty();
       }
 
+      // i64 -> i64
+      if (type_ == KW_I64) {
+        return builder->getInt64Ty();
+      }
+
+      // f64 -> double
+      if (type_ == KW_F64) {
+        return builder->getDoubleTy();
+      }
+
       // string ->i8*
-      if (type_ == "string") {
+      if (type_ == KW_STRING) {
         return builder->getInt8Ty()->getPointerTo();
       }
 
       // class
-      return classMap_[type_].cls->getPointerTo();
+      return getClassPointerType(classMap_[type_].cls);
+    }
+
+    /*
+      Type of the pointers to the instances of a class.
+    */
+    llvm::PointerType* getClassPointerType(llvm::StructType* cls) {
+      return cls->getPointerTo(options.preciseGC ? GC_ADDRESS_SPACE : 0);
+    }
+
+    /*
+      Whether a value of the type is an object pointer
+      the precise collector tracks.
+    */
+    bool isGCPointerType(llvm::Type* type_) {
+      return options.preciseGC && type_->isPointerTy() && type_->getPointerAddressSpace() == GC_ADDRESS_SPACE;
     }
 
     /*
       If a function has a return type defined or not
     */
     bool hasReturnType(const Exp& fnExp) {
-      return fnExp.list[3].type == ExpType::SYMBOL && fnExp.list[3].string == "->";
+      return fnExp.list[3].type == ExpType::SYMBOL && fnExp.list[3].id == KW_ARROW;
     }
 
     /*
       TODO: add description
     */
     llvm::FunctionType* extractFunctionType(const Exp& fnExp) {
-      auto params = fnExp.list[2];
+      const auto& params = fnExp.list[2];
 
       // return type
-      auto returnType = hasReturnType(fnExp) ? getTypeFromString(fnExp.list[4].string) : builder->getInt32Ty();
+      auto returnType = hasReturnType(fnExp) ? getTypeFromExp(fnExp.list[4]) : builder->getInt32Ty();
 
       // param types
       std::vector<llvm::Type*> paramTypes{};
 
       // collect the args for a fn
       for (auto& param : params.list) {
-        auto paramName = extractVarName(param);
+        auto paramName = extractVarId(param);
         auto paramTy = extractVarType(param);
 
         // if self add a pointer to the class itself
         paramTypes.push_back(
-            paramName == "self" ? (llvm::Type*)cls->getPointerTo() : paramTy);
+            paramName == KW_SELF ? (llvm::Type*)getClassPointerType(cls) : paramTy);
       }
 
       return llvm::FunctionType::get(returnType, paramTypes, /* varargs */ false);
@@ -868,46 +2418,148 @@ class EvaLLVM {
       Untyped example: (def square (x) (* x x)) - i32 by default
       Typed example: (def square ((a number)) -> number (* x x))
     */
-    llvm::Value* compileFunction(const Exp& fnExp, std::string fnName, Env env) {
-      auto params = fnExp.list[2];
-      auto body = hasReturnType(fnExp) ? fnExp.list[5] : fnExp.list[3];
-
-      // save current function.
-      auto prevFn = fn;
-      auto prevBlock = builder->GetInsertBlock();
+    llvm::Value* compileFunction(const Exp& fnExp, std::string fnName) {
+      const auto& params = fnExp.list[2];
+      const auto& body = hasReturnType(fnExp) ? fnExp.list[5] : fnExp.list[3];
 
       // class methods
       if (cls != nullptr) {
         fnName = std::string(cls->getName().data()) + "_" + fnName;
       }
 
+      std::vector<std::pair<std::string, uint32_t>> paramBindings;
+
+      for (auto& param : params.list) {
+        paramBindings.emplace_back(extractVarName(param), extractVarSlot(param));
+      }
+
+      return compileFunctionBody(fnName, extractFunctionType(fnExp), paramBindings, body, &fnExp.list[1]);
+    }
+
+    /*
+      Compiles a lambda to a function which takes the captured
+      values, then the params: lambda_<n>
+      (lambda <params> [-> <type>] <body>)
+    */
+    LambdaInfo compileLambda(const Exp& exp) {
+      const auto& params = exp.list[1];
+      bool typed = exp.list[2].type == ExpType::SYMBOL && exp.list[2].id == KW_ARROW;
+      const auto& body = typed ? exp.list[4] : exp.list[2];
+
+      LambdaInfo lambda{nullptr, {}};
+
+      std::vector<llvm::Type*> paramTypes;
+      std::vector<std::pair<std::string, uint32_t>> paramBindings;
+
+      // the captured values are copied when the lambda is created
+      for (auto slot : resolver.captures(exp)) {
+        auto binding = bindings_[slot];
+        auto value = llvm::isa<llvm::AllocaInst>(binding)
+          ? builder->CreateLoad(((llvm::AllocaInst*)binding)->getAllocatedType(), binding, binding->getName())
+          : liftedBindings_.count(slot) ? createClosure(liftedBindings_[slot], /* on stack */ false) : binding;
+
+        lambda.captures.push_back(value);
+        paramTypes.push_back(value->getType());
+        paramBindings.emplace_back(binding->getName().str(), slot);
+      }
+
+      for (auto& param : params.list) {
+        paramTypes.push_back(extractVarType(param));
+        paramBindings.emplace_back(extractVarName(param), extractVarSlot(param));
+      }
+
+      auto returnType = typed ? getTypeFromExp(exp.list[3]) : builder->getInt32Ty();
+      auto fnType = llvm::FunctionType::get(returnType, paramTypes, /* varargs */ false);
+
+      // the body of a lambda in a method is not a class body
+      auto prevCls = cls;
+      cls = nullptr;
+      lambda.fn = compileFunctionBody("lambda_" + std::to_string(lambdasCount_++), fnType,
+                                      paramBindings, body, /* name */ nullptr);
+      cls = prevCls;
+
+      return lambda;
+    }
+
+    /*
+      Compiles the body of a function. The params are mutable locals,
+      bound to their slots in the body only (a captured variable keeps
+      its binding outside of the lambda). A named function is visible
+      in its own body.
+    */
+    llvm::Function* compileFunctionBody(const std::string& fnName, llvm::FunctionType* fnType,
+                                        const std::vector<std::pair<std::string, uint32_t>>& params,
+                                        const Exp& body, const Exp* name) {
+      // save current function.
+      auto prevFn = fn;
+      auto prevBlock = builder->GetInsertBlock();
+
+      // break and continue don't cross functions
+      auto prevLoops = std::move(loops_);
+      loops_.clear();
+
+      // nor do tail calls
+      auto prevTailCalls = std::move(tailCalls_);
+      auto prevTailParams = std::move(tailParams_);
+      auto prevTailRecurseBlock = tailRecurseBlock_;
+      auto prevTailRecurseFrom = tailRecurseFrom_;
+      tailCalls_.clear();
+      tailParams_.clear();
+      tailRecurseBlock_ = nullptr;
+
       // override function to compile the body.
-      auto newFn = createFunction(fnName, extractFunctionType(fnExp), env);
+      auto newFn = createFunction(fnName, fnType);
       fn = newFn;
+      recursiveGroup_.insert(newFn);
+
+      // the function is visible in its own body
+      if (name != nullptr) {
+        bindings_[name->slot] = newFn;
+      }
+
+      std::vector<llvm::Value*> prevBindings;
 
       // set param names
       auto idx = 0;
 
-      auto fnEnv = std::make_shared<Environment>(
-        std::map<std::string, llvm::Value*>{}, env);
-
       for (auto& arg : fn->args()) {
-        auto param = params.list[idx++];
-        auto argName = extractVarName(param);
+        const auto& param = params[idx++];
 
-        arg.setName(argName);
+        arg.setName(param.first);
 
         // allocate the local variable as per 
         // the argument to make mutable arguments
-        auto argBinding = allocVar(argName, arg.getType(), fnEnv);
+        prevBindings.push_back(bindings_[param.second]);
+        auto argBinding = allocVar(param.first, param.second, arg.getType());
         builder->CreateStore(&arg, argBinding);
+        tailParams_.push_back((llvm::AllocaInst*)argBinding);
       }
 
-      builder->CreateRet(gen(body, fnEnv));
+      collectTailCalls(body);
+
+      // self tail calls jump back after the prologue
+      tailRecurseFrom_ = builder->GetInsertBlock()->empty() ? nullptr : &builder->GetInsertBlock()->back();
+
+      auto result = gen(body);
+
+      // unless a tail call returned already
+      if (!blockTerminated()) {
+        builder->CreateRet(castValue(result, fn->getReturnType()));
+      }
 
       // restore previous function after compiling
       builder->SetInsertPoint(prevBlock);
       fn = prevFn;
+      loops_ = std::move(prevLoops);
+      tailCalls_ = std::move(prevTailCalls);
+      tailParams_ = std::move(prevTailParams);
+      tailRecurseBlock_ = prevTailRecurseBlock;
+      tailRecurseFrom_ = prevTailRecurseFrom;
+      recursiveGroup_.erase(newFn);
+
+      for (auto i = 0; i < params.size(); i++) {
+        bindings_[params[i].second] = prevBindings[i];
+      }
 
       return newFn;
     }
@@ -916,17 +2568,50 @@ class EvaLLVM {
       Allocating a local variable on the stack.
       results in alloca instruction.
     */
-    llvm::Value* allocVar(const std::string& name, llvm::Type* type_, Env env) {
-      varsBuilder->SetInsertPoint(&fn->getEntryBlock());
-
-      auto varAlloc = varsBuilder->CreateAlloca(type_, 0, name.c_str());
+    llvm::Value* allocVar(const std::string& name, uint32_t slot, llvm::Type* type_) {
+      auto varAlloc = createEntryAlloca(type_, name);
 
-      // add to the env
-      env->define(name, varAlloc);
+      // bind to the variable's slot
+      bindings_[slot] = varAlloc;
 
       return varAlloc;
     }
 
+    /*
+      Creates an alloca after the previous ones, at the start of
+      the entry block (the block may already have a terminator).
+    */
+    llvm::AllocaInst* createEntryAlloca(llvm::Type* type_, const std::string& name) {
+      auto& entry = fn->getEntryBlock();
+      auto& lastAlloca = lastAllocas_[fn];
+
+      if (lastAlloca == nullptr) {
+        varsBuilder->SetInsertPoint(&entry, entry.begin());
+      } else {
+        varsBuilder->SetInsertPoint(&entry, ++lastAlloca->getIterator());
+      }
+
+      lastAlloca = varsBuilder->CreateAlloca(type_, 0, name.c_str());
+
+      return lastAlloca;
+    }
+
+    /*
+      LLVM constant of a compile-time value
+    */
+    llvm::Constant* getConstant(const ConstValue& value) {
+      switch (value.type) {
+        case ConstType::BOOL:
+          return builder->getInt1(value.integer);
+        case ConstType::I32:
+          return builder->getInt32(value.integer);
+        case ConstType::I64:
+          return builder->getInt64(value.integer);
+        default:
+          return llvm::ConstantFP::get(builder->getDoubleTy(), value.decimal);
+      }
+    }
+
     /*
       Creates a global variable
     */
@@ -962,18 +2647,86 @@ class EvaLLVM {
       // size_t is i64
       module->getOrInsertFunction("GC_malloc", llvm::FunctionType::get(bytePtrTy, builder->getInt64Ty(), 
                                                                                 /* vararg */ false));
+
+      // runtime allocation (runtime/EvaRuntime.h): class descriptors
+      // { size, pointers bitmap, collector descriptor, array elements, kind },
+      // the class nurseries { cursor, limit, stride, list } and their slow path
+      auto int64Ty = builder->getInt64Ty();
+      auto descriptorTy = llvm::StructType::create(*ctx, {int64Ty, int64Ty->getPointerTo(), int64Ty, int64Ty,
+                                                          int64Ty, int64Ty, int64Ty},
+                                                   "EvaClassDescriptor");
+      auto nurseryTy = llvm::StructType::create(*ctx, {bytePtrTy, bytePtrTy, int64Ty, bytePtrTy, int64Ty,
+                                                       int64Ty, int64Ty, int64Ty},
+                                                "EvaNursery");
+
+      module->getOrInsertFunction("eva_alloc_class",
+        llvm::FunctionType::get(bytePtrTy, descriptorTy->getPointerTo(), /* vararg */ false));
+
+      auto allocSlow = module->getOrInsertFunction("eva_alloc_class_slow",
+        llvm::FunctionType::get(bytePtrTy, {nurseryTy->getPointerTo(), descriptorTy->getPointerTo()},
+                                /* vararg */ false));
+      llvm::cast<llvm::Function>(allocSlow.getCallee())->addFnAttr(llvm::Attribute::Cold);
+
+      // arrays: the vTable only has the descriptor, out of bounds accesses exit
+      llvm::StructType::create(*ctx, {descriptorTy->getPointerTo()}, "EvaArray_vTable");
+
+      module->getOrInsertFunction("eva_alloc_array",
+        llvm::FunctionType::get(bytePtrTy, {descriptorTy->getPointerTo(), int64Ty}, /* vararg */ false));
+
+      auto indexError = llvm::cast<llvm::Function>(module->getOrInsertFunction("eva_array_index_error",
+        llvm::FunctionType::get(builder->getVoidTy(), {int64Ty, int64Ty}, /* vararg */ false)).getCallee());
+      indexError->addFnAttr(llvm::Attribute::Cold);
+      indexError->addFnAttr(llvm::Attribute::NoReturn);
+      indexError->addFnAttr(llvm::Attribute::NoUnwind);
+
+      if (options.preciseGC) {
+        setupPreciseGCFunctions(descriptorTy);
+      }
+    }
+
+    /*
+      The precise collector (runtime/EvaGC.h): the young generation
+      { cursor, limit }, its slow path, the array allocation, and the
+      write barrier. The
+      calls which can't collect aren't statepoints (gc-leaf-function).
+    */
+    void setupPreciseGCFunctions(llvm::StructType* descriptorTy) {
+      auto gcBytePtrTy = builder->getInt8Ty()->getPointerTo(GC_ADDRESS_SPACE);
+
+      auto youngTy = llvm::StructType::create(*ctx, {gcBytePtrTy, gcBytePtrTy}, "EvaYoungGeneration");
+      new llvm::GlobalVariable(*module, youngTy, /* constant */ false,
+                               llvm::GlobalValue::ExternalLinkage, nullptr, "eva_gc_young");
+
+      auto allocSlow = module->getOrInsertFunction("eva_gc_alloc_slow",
+        llvm::FunctionType::get(gcBytePtrTy, descriptorTy->getPointerTo(), /* vararg */ false));
+      llvm::cast<llvm::Function>(allocSlow.getCallee())->addFnAttr(llvm::Attribute::Cold);
+
+      module->getOrInsertFunction("eva_gc_alloc_array",
+        llvm::FunctionType::get(gcBytePtrTy, {descriptorTy->getPointerTo(), builder->getInt64Ty()},
+                                /* vararg */ false));
+
+      auto writeBarrier = module->getOrInsertFunction("eva_gc_write_barrier",
+        llvm::FunctionType::get(builder->getVoidTy(), gcBytePtrTy->getPointerTo(GC_ADDRESS_SPACE),
+                                /* vararg */ false));
+      llvm::cast<llvm::Function>(writeBarrier.getCallee())->addFnAttr("gc-leaf-function");
+
+      module->getFunction("printf")->addFnAttr("gc-leaf-function");
+      module->getFunction("eva_array_index_error")->addFnAttr("gc-leaf-function");
     }
 
     /*
       creates a function prototype (defines function, not the body)
     */
-    llvm::Function* createFunctionProto(const std::string& fnName, llvm::FunctionType* fnType, Env env) {
+    llvm::Function* createFunctionProto(const std::string& fnName, llvm::FunctionType* fnType) {
       auto fn = llvm::Function::Create(fnType, llvm::Function::ExternalLinkage, fnName, *module);
 
-      verifyFunction(*fn);
+      // statepoints at the calls, the collector walks the frame pointers
+      if (options.preciseGC) {
+        fn->setGC("statepoint-example");
+        fn->addFnAttr("frame-pointer", "all");
+      }
 
-      // define in environment
-      env->define(fnName, fn);
+      verifyFunction(*fn);
 
       return fn;
     }
@@ -981,13 +2734,13 @@ class EvaLLVM {
     /*
       creates a function
     */
-    llvm::Function* createFunction(const std::string& fnName, llvm::FunctionType* fnType, Env env) {
+    llvm::Function* createFunction(const std::string& fnName, llvm::FunctionType* fnType) {
       // function prototype maybe defined
       auto fn = module->getFunction(fnName);
 
       // if not prototype, allocate the function
       if (fn == nullptr) {
-        fn = createFunctionProto(fnName, fnType, env);
+        fn = createFunctionProto(fnName, fnType);
       }
 
       createFunctionalBlock(fn);
@@ -1010,6 +2763,79 @@ class EvaLLVM {
       return llvm::BasicBlock::Create(*ctx, name, fn);
     }
 
+    /*
+      Runs the standard new pass manager pipeline for the
+      optimization level, with the Eva passes registered.
+      -O0 leaves the module as generated, except for the
+      statepoints of the precise collector.
+    */
+    void optimizeModule() {
+      static const llvm::OptimizationLevel levels[] = {
+        llvm::OptimizationLevel::O0,
+        llvm::OptimizationLevel::O1,
+        llvm::OptimizationLevel::O2,
+        llvm::OptimizationLevel::O3,
+      };
+
+      if (options.optLevel == 0 && !options.preciseGC) {
+        return;
+      }
+
+      llvm::LoopAnalysisManager loopAnalyses;
+      llvm::FunctionAnalysisManager functionAnalyses;
+      llvm::CGSCCAnalysisManager cgsccAnalyses;
+      llvm::ModuleAnalysisManager moduleAnalyses;
+
+      // the target machine provides the cost model (TTI)
+      llvm::PassBuilder passBuilder(targetMachine.get());
+
+      // Eva passes hook into the pipeline extension points
+      registerEvaPasses(passBuilder);
+
+      passBuilder.registerModuleAnalyses(moduleAnalyses);
+      passBuilder.registerCGSCCAnalyses(cgsccAnalyses);
+      passBuilder.registerFunctionAnalyses(functionAnalyses);
+      passBuilder.registerLoopAnalyses(loopAnalyses);
+      passBuilder.crossRegisterProxies(loopAnalyses, functionAnalyses,
+                                       cgsccAnalyses, moduleAnalyses);
+
+      llvm::ModulePassManager modulePasses;
+
+      if (options.optLevel > 0) {
+        auto level = levels[std::min(options.optLevel, 3u)];
+        modulePasses = passBuilder.buildPerModuleDefaultPipeline(level);
+      }
+
+      // the calls which may collect become statepoints, last: the
+      // optimizations don't know about the relocations. the object
+      // pointers must be SSA values to be tracked (mem2reg at -O0)
+      if (options.preciseGC) {
+        if (options.optLevel == 0) {
+          modulePasses.addPass(llvm::createModuleToFunctionPassAdaptor(llvm::PromotePass()));
+        }
+        modulePasses.addPass(llvm::RewriteStatepointsForGC());
+      }
+
+      modulePasses.run(*module, moduleAnalyses);
+
+      if (options.preciseGC) {
+        exportStackMaps();
+      }
+    }
+
+    /*
+      The stack maps section of the statepoints is found by the
+      collector through its symbol, which LLVM emits as local.
+    */
+    void exportStackMaps() {
+      for (auto& function : *module) {
+        if (function.getIntrinsicID() == llvm::Intrinsic::experimental_gc_statepoint && !function.use_empty()) {
+          module->appendModuleInlineAsm(".globl __LLVM_StackMaps");
+          return;
+        }
+      }
+    }
+
     /*
       save the IR to the file.
     */
@@ -1019,6 +2845,23 @@ class EvaLLVM {
       module->print(outLL, nullptr);
     }
 
+    /*
+      Returns the string constant for a literal, identical
+      literals share one private unnamed_addr global.
+    */
+    llvm::Constant* getStringConstant(std::string_view str) {
+      auto& constant = stringPool_[llvm::StringRef(str.data(), str.size())];
+
+      if (constant == nullptr) {
+        // CreateGlobalStringPtr: is used to create a string constant
+        // in the global scope of the program
+        constant = builder->CreateGlobalStringPtr(
+          llvm::StringRef(str.data(), str.size()));
+      }
+
+      return constant;
+    }
+
     /*
       Module init
     */
@@ -1032,6 +2875,14 @@ class EvaLLVM {
 
       // builder for variables.
       varsBuilder = std::make_unique<llvm::IRBuilder<>>(*ctx);
+
+      // f64 ops may be reassociated, contracted, etc.
+      if (options.fastMath) {
+        builder->setFastMathFlags(llvm::FastMathFlags::getFast());
+      }
+
+      // string constants belong to the module.
+      stringPool_.clear();
     }
 
     /*
@@ -1042,23 +2893,93 @@ class EvaLLVM {
         {"VERSION", builder->getInt32(1)},
       };
 
-      std::map<std::string, llvm::Value*> globalRec{};
-
+      // globals are bound in the outermost scope
       for (auto& entry: globalObject) {
-        globalRec[entry.first] = 
-          createGlobalVar(entry.first, (llvm::Constant*)entry.second);
+        auto slot = resolver.define(intern(entry.first));
+        bindings_.resize(resolver.slotsCount());
+
+        bindings_[slot] = createGlobalVar(entry.first, (llvm::Constant*)entry.second);
+      }
+    }
+
+    /*
+      Setup the target: the host or --target triple. The module's
+      DataLayout comes from the target machine, so type sizes
+      (e.g. for GC_malloc) match the generated code.
+    */
+    void setupTargetMachine() {
+      llvm::InitializeAllTargetInfos();
+      llvm::InitializeAllTargets();
+      llvm::InitializeAllTargetMCs();
+      llvm::InitializeAllAsmPrinters();
+      // module asm (the stack maps symbol of the precise collector)
+      llvm::InitializeAllAsmParsers();
+
+      auto isHost = options.targetTriple.empty();
+      auto triple = isHost ? llvm::sys::getDefaultTargetTriple() : options.targetTriple;
+
+      std::string error;
+      auto target = llvm::TargetRegistry::lookupTarget(triple, error);
+
+      if (target == nullptr) {
+        DIE << "[EvaLLVM]: Unknown target " << triple << ": " << error << std::endl;
+      }
+
+      // tune for the host CPU when compiling for the host
+      std::string cpu = "generic";
+      llvm::SubtargetFeatures features;
+
+      if (isHost) {
+        cpu = llvm::sys::getHostCPUName().str();
+
+        llvm::StringMap<bool> hostFeatures;
+        if (llvm::sys::getHostCPUFeatures(hostFeatures)) {
+          for (auto& feature : hostFeatures) {
+            features.AddFeature(feature.first(), feature.second);
+          }
+        }
       }
 
-      GlobalEnv = std::make_shared<Environment>(globalRec, nullptr);
+      targetMachine.reset(target->createTargetMachine(
+        triple, cpu, features.getString(), llvm::TargetOptions(), llvm::Reloc::PIC_));
+
+      module->setTargetTriple(triple);
+      module->setDataLayout(targetMachine->createDataLayout());
+
+      // the object pointers of the precise collector are non-integral:
+      // the optimizer doesn't turn them into integers, which the
+      // collector couldn't relocate
+      if (options.preciseGC) {
+        module->setDataLayout(module->getDataLayoutStr() + "-ni:" + std::to_string(GC_ADDRESS_SPACE));
+      }
     }
 
     /*
-      Setup the target triple.
+      Emits the module as a native object file.
     */
-    void setupTargetTriple() {
-      module->setTargetTriple("arm64-apple-macosx14.0.0");
+    void emitObjectFile(const std::string& fileName) {
+      std::error_code errorCode;
+      llvm::raw_fd_ostream out(fileName, errorCode, llvm::sys::fs::OF_None);
+
+      if (errorCode) {
+        DIE << "[EvaLLVM]: Cannot open file \"" << fileName << "\": " << errorCode.message() << std::endl;
+      }
+
+      // the codegen pipeline still runs on the legacy pass manager
+      llvm::legacy::PassManager codegenPasses;
+
+      if (targetMachine->addPassesToEmitFile(codegenPasses, out, nullptr, llvm::CGFT_ObjectFile)) {
+        DIE << "[EvaLLVM]: The target cannot emit object files." << std::endl;
+      }
+
+      codegenPasses.run(*module);
     }
 
+    /*
+      Compiler options
+    */
+    CompilerOptions options;
+
     /*
       Eva Parser
     */
@@ -1070,14 +2991,104 @@ class EvaLLVM {
     llvm::StructType* cls = nullptr;
 
     /*
-      Class information
+      Class information, keyed by the interned class name
+    */
+    std::unordered_map<SymbolId, ClassInfo> classMap_;
+
+    /*
+      Class information by class type
+    */
+    llvm::DenseMap<llvm::StructType*, ClassInfo*> classInfos_;
+
+    /*
+      Array types by element type
+    */
+    llvm::DenseMap<llvm::Type*, llvm::StructType*> arrayTypes_;
+
+    /*
+      Closure types by signature, and by vTable type
+    */
+    llvm::DenseMap<llvm::FunctionType*, llvm::StructType*> closureSignatures_;
+    llvm::DenseMap<llvm::Type*, llvm::StructType*> closureVTables_;
+    llvm::DenseSet<llvm::Type*> closureTypes_;
+
+    /*
+      Environment classes of the lambdas, by lifted function
+    */
+    llvm::DenseMap<llvm::Function*, llvm::StructType*> environments_;
+
+    /*
+      Lambdas bound to variables which are only called, by slot
+    */
+    llvm::DenseMap<uint32_t, LambdaInfo> liftedBindings_;
+
+    /*
+      Compiled lambdas, for the names
+    */
+    size_t lambdasCount_ = 0;
+
+    /*
+      Special forms dispatch table, indexed by keyword id
+    */
+    std::array<SpecialForm, KEYWORDS_COUNT> specialForms_{};
+
+    /*
+      String constants of the module, keyed by contents
+    */
+    llvm::StringMap<llvm::Constant*> stringPool_;
+
+    /*
+      Name resolution pass (symbol table)
+    */
+    Resolver resolver;
+
+    /*
+      Escape analysis of the instances
+    */
+    EscapeAnalysis escapeAnalysis{resolver};
+
+    /*
+      Compile-time evaluation of the constants and pure calls
     */
-    std::map<std::string, ClassInfo> classMap_;
+    ConstEvaluator constEvaluator;
 
     /*
-      Global Enviroment (symbol table)
+      Enclosing loops of the code being compiled, innermost last:
+      the targets of continue and break
     */
-    std::shared_ptr<Environment> GlobalEnv;
+    struct LoopTargets {
+      llvm::BasicBlock* next;
+      llvm::BasicBlock* exit;
+    };
+
+    std::vector<LoopTargets> loops_;
+
+    /*
+      Tail calls of the function being compiled, its params,
+      the start of its body (loopTailCalls, created on the first
+      self tail call) and the last instruction of its prologue
+    */
+    llvm::DenseSet<const Exp*> tailCalls_;
+    std::vector<llvm::AllocaInst*> tailParams_;
+    llvm::BasicBlock* tailRecurseBlock_ = nullptr;
+    llvm::Instruction* tailRecurseFrom_ = nullptr;
+
+    /*
+      Functions being compiled: the current one and the ones
+      enclosing it, the targets of musttail calls
+    */
+    llvm::SmallPtrSet<llvm::Function*, 8> recursiveGroup_;
+
+    /*
+      Last alloca of the entry block, per function
+    */
+    llvm::DenseMap<llvm::Function*, llvm::AllocaInst*> lastAllocas_;
+
+    /*
+      Values of the resolved bindings, indexed by slot:
+      allocas, globals, functions and instances
+    */
+    std::vector<llvm::Value*> bindings_;
 
     /*
       currently compiling functions.
@@ -1096,6 +3107,11 @@ class EvaLLVM {
     */
     std::unique_ptr<llvm::Module> module;
 
+    /*
+      Target the module is compiled for
+    */
+    std::unique_ptr<llvm::TargetMachine> targetMachine;
+
     /*
       TODO: add more info
     */
@@ -0,0 +1,102 @@
+/*
+    Eva optimization passes and their registration in the pipeline.
+*/
+#ifndef EvaPasses_h
+#define EvaPasses_h
+
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Transforms/IPO/LowerTypeTests.h"
+#include "llvm/Transforms/IPO/WholeProgramDevirt.h"
+
+/*
+  Removes the redundant bitcasts the code generator emits for
+  arguments of class types: no-op casts, casts of casts, and
+  repeated casts of the same value in a block.
+*/
+class RemoveRedundantBitCastsPass : public llvm::PassInfoMixin<RemoveRedundantBitCastsPass> {
+public:
+    llvm::PreservedAnalyses run(llvm::Function& fn, llvm::FunctionAnalysisManager&) {
+        bool changed = false;
+        std::vector<llvm::Instruction*> dead;
+
+        for (auto& block : fn) {
+            // first cast of (value, type) in the block, it dominates the later ones
+            llvm::DenseMap<std::pair<llvm::Value*, llvm::Type*>, llvm::BitCastInst*> casts;
+
+            for (auto& inst : block) {
+                auto cast = llvm::dyn_cast<llvm::BitCastInst>(&inst);
+                if (cast == nullptr) {
+                    continue;
+                }
+
+                // (bitcast (bitcast x)) -> (bitcast x)
+                auto source = cast->getOperand(0);
+                while (auto sourceCast = llvm::dyn_cast<llvm::BitCastInst>(source)) {
+                    source = sourceCast->getOperand(0);
+                }
+
+                if (source != cast->getOperand(0)) {
+                    cast->setOperand(0, source);
+                    changed = true;
+                }
+
+                // no-op cast
+                if (source->getType() == cast->getType()) {
+                    cast->replaceAllUsesWith(source);
+                    dead.push_back(cast);
+                    continue;
+                }
+
+                auto& first = casts[{source, cast->getType()}];
+
+                if (first == nullptr) {
+                    first = cast;
+                } else {
+                    cast->replaceAllUsesWith(first);
+                    dead.push_back(cast);
+                }
+            }
+        }
+
+        for (auto inst : dead) {
+            inst->eraseFromParent();
+        }
+
+        if (!changed && dead.empty()) {
+            return llvm::PreservedAnalyses::all();
+        }
+
+        llvm::PreservedAnalyses preserved;
+        preserved.preserveSet<llvm::CFGAnalyses>();
+        return preserved;
+    }
+};
+
+/*
+  Registers the Eva passes into the pipeline built by the pass builder,
+  through its extension points. New Eva passes are added here.
+*/
+inline void registerEvaPasses(llvm::PassBuilder& passBuilder) {
+    passBuilder.registerPipelineStartEPCallback(
+        [](llvm::ModulePassManager& modulePasses, llvm::OptimizationLevel) {
+            // the whole program is one module: devirtualize method calls
+            // using the vTables !type metadata, as in a regular LTO link.
+            // lowering the type tests lays out the vTables together, which
+            // the branch funnels of polymorphic calls rely on (x86-64),
+            // then the remaining type tests are dropped
+            modulePasses.addPass(llvm::WholeProgramDevirtPass(nullptr, nullptr));
+            modulePasses.addPass(llvm::LowerTypeTestsPass(nullptr, nullptr));
+            modulePasses.addPass(llvm::LowerTypeTestsPass(nullptr, nullptr, /* drop type tests */ true));
+
+            modulePasses.addPass(llvm::createModuleToFunctionPassAdaptor(RemoveRedundantBitCastsPass()));
+        });
+}
+
+#endif
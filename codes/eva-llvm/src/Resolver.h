@@ -0,0 +1,347 @@
+/*
+    Resolver: name resolution pass run before code generation.
+
+    Every definition of a variable, parameter or function gets its
+    own binding slot, and every reference is annotated with the slot
+    of the definition it resolves to (Exp::slot). Code generation then
+    reads and writes bindings by slot, without any lookups.
+
+    The locals of the enclosing functions a lambda refers to are its
+    captures, copied when the lambda is created.
+*/
+#ifndef Resolver_h
+#define Resolver_h
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "./parser/Exp.h"
+#include "./Logger.h"
+
+class Resolver {
+public:
+    Resolver() { beginScope(); }
+
+    // resolves all names in an expression, scoping
+    // follows the code generation of the special forms
+    void resolve(const Exp& exp) {
+        switch (exp.type) {
+            case ExpType::SYMBOL:
+                if (exp.id != KW_TRUE && exp.id != KW_FALSE) {
+                    exp.slot = lookup(exp.id);
+                    capture(exp.slot);
+                }
+                return;
+
+            case ExpType::NUMBER:
+            case ExpType::FLOAT:
+            case ExpType::STRING:
+                return;
+
+            case ExpType::LIST:
+                break;
+        }
+
+        const auto& tag = exp.list[0];
+
+        // function and method calls
+        if (tag.type != ExpType::SYMBOL || tag.id >= KEYWORDS_COUNT) {
+            resolveList(exp, 0);
+            return;
+        }
+
+        switch (tag.id) {
+            // (begin <exp>...)
+            case KW_BEGIN:
+                beginScope();
+                resolveList(exp, 1);
+                endScope();
+                return;
+
+            // (var <name> <init>)
+            case KW_VAR:
+                // class fields are not variables
+                if (inClass_) {
+                    return;
+                }
+                resolve(exp.list[2]);
+                defineVar(exp.list[1]);
+                return;
+
+            // (const <name> <exp>): a global, even in a function
+            case KW_CONST:
+                resolve(exp.list[2]);
+                exp.list[1].slot = define(exp.list[1].id);
+                return;
+
+            // (set <name> <value>) or (set (prop <instance> <field>) <value>)
+            case KW_SET:
+                resolve(exp.list[2]);
+                if (isTaggedList(exp.list[1], KW_PROP)) {
+                    resolve(exp.list[1].list[1]);
+                } else {
+                    resolve(exp.list[1]);
+                    if (isCapture(exp.list[1].slot)) {
+                        DIE << "Cannot set the captured variable \"" << exp.list[1].string() << "\"." << std::endl;
+                    }
+                }
+                return;
+
+            // (for (<name> <start> <end> [<step>]) <body> <options>...):
+            // the bounds are outside the loop scope (a malformed
+            // header is reported by the code generator)
+            case KW_FOR:
+                if (exp.list.size() < 3 || exp.list[1].type != ExpType::LIST || exp.list[1].list.empty() ||
+                    exp.list[1].list[0].type != ExpType::SYMBOL) {
+                    return;
+                }
+                resolveList(exp.list[1], 1);
+                beginScope();
+                defineVar(exp.list[1].list[0]);
+                resolve(exp.list[2]);
+                endScope();
+                return;
+
+            // (break), (continue)
+            case KW_BREAK:
+            case KW_CONTINUE:
+                return;
+
+            // (def <name> <params> [-> <type>] <body>)
+            case KW_DEF:
+                resolveFunction(exp);
+                return;
+
+            // (lambda <params> [-> <type>] <body>)
+            case KW_LAMBDA:
+                resolveLambda(exp);
+                return;
+
+            // (class <name> <super> <body>)
+            case KW_CLASS:
+                resolveClass(exp);
+                return;
+
+            // (new <class> <args>...)
+            case KW_NEW:
+                resolveList(exp, 2);
+                return;
+
+            // (new-array <type> <length>)
+            case KW_NEW_ARRAY:
+                resolve(exp.list[2]);
+                return;
+
+            // (prop <instance> <name>)
+            case KW_PROP:
+                resolve(exp.list[1]);
+                return;
+
+            // (method <instance> <name>) or (method (super <class>) <name>)
+            case KW_METHOD:
+                if (!isTaggedList(exp.list[1], KW_SUPER)) {
+                    resolve(exp.list[1]);
+                }
+                return;
+
+            // operators, if, while, printf, arrays: all operands are expressions
+            case KW_ADD: case KW_SUB: case KW_MUL: case KW_DIV:
+            case KW_GT: case KW_LT: case KW_EQ: case KW_NE: case KW_GE: case KW_LE:
+            case KW_IF: case KW_WHILE: case KW_PRINTF:
+            case KW_AREF: case KW_ASET: case KW_LEN:
+                resolveList(exp, 1);
+                return;
+
+            // other keywords in call position are called as functions
+            default:
+                resolveList(exp, 0);
+                return;
+        }
+    }
+
+    // defines a name in the current scope, returns its new slot
+    uint32_t define(SymbolId name) {
+        if (name >= current_.size()) {
+            current_.resize(name + 1, NO_SLOT);
+        }
+
+        // remember the shadowed binding, restored at the end of the scope
+        shadowed_.emplace_back(name, current_[name]);
+
+        current_[name] = slotsCount_;
+        slotDepths_.push_back(NOT_LOCAL);
+        return slotsCount_++;
+    }
+
+    // opens a block scope
+    void beginScope() { scopes_.push_back(shadowed_.size()); }
+
+    // closes a block scope, restoring the shadowed bindings
+    void endScope() {
+        auto mark = scopes_.back();
+        scopes_.pop_back();
+
+        while (shadowed_.size() > mark) {
+            current_[shadowed_.back().first] = shadowed_.back().second;
+            shadowed_.pop_back();
+        }
+    }
+
+    // number of slots allocated so far
+    uint32_t slotsCount() const { return slotsCount_; }
+
+    // slots captured by a lambda, in the order of their first reference
+    const std::vector<uint32_t>& captures(const Exp& lambdaExp) const {
+        static const std::vector<uint32_t> none;
+        auto it = captures_.find(&lambdaExp);
+        return it == captures_.end() ? none : it->second;
+    }
+
+private:
+    // returns the slot of the visible definition of a name
+    uint32_t lookup(SymbolId name) {
+        if (name >= current_.size() || current_[name] == NO_SLOT) {
+            DIE << "Variable \"" << SymbolTable::global().name(name) << "\" is not defined." << std::endl;
+        }
+        return current_[name];
+    }
+
+    // resolves list items starting from `from`
+    void resolveList(const Exp& exp, size_t from) {
+        for (auto i = from; i < exp.list.size(); i++) {
+            resolve(exp.list[i]);
+        }
+    }
+
+    // x or (x <type>): the slot is stored on the name symbol,
+    // a local of the current function
+    void defineVar(const Exp& decl) {
+        const auto& name = decl.type == ExpType::LIST ? decl.list[0] : decl;
+        name.slot = define(name.id);
+        slotDepths_[name.slot] = functions_.size();
+    }
+
+    // the function name is visible in its body (recursion),
+    // params are in the function scope, which sees the enclosing ones
+    void resolveFunction(const Exp& fnExp) {
+        // methods are defined by their class
+        if (!inClass_) {
+            fnExp.list[1].slot = define(fnExp.list[1].id);
+        }
+
+        functions_.push_back(nullptr);
+        resolveParamsAndBody(fnExp.list[2], fnExp, 3);
+        functions_.pop_back();
+    }
+
+    // a function without a name, which captures the locals
+    // of the enclosing functions it refers to
+    void resolveLambda(const Exp& lambdaExp) {
+        captures_[&lambdaExp].clear();
+
+        // the vars of a lambda in a method are locals, not fields
+        auto prevInClass = inClass_;
+        inClass_ = false;
+
+        functions_.push_back(&lambdaExp);
+        resolveParamsAndBody(lambdaExp.list[1], lambdaExp, 2);
+        functions_.pop_back();
+
+        inClass_ = prevInClass;
+    }
+
+    // the body follows the params, or the return type at `next`
+    void resolveParamsAndBody(const Exp& params, const Exp& fnExp, size_t next) {
+        beginScope();
+
+        for (const auto& param : params.list) {
+            defineVar(param);
+        }
+
+        bool hasReturnType = fnExp.list[next].type == ExpType::SYMBOL && fnExp.list[next].id == KW_ARROW;
+        resolve(fnExp.list[hasReturnType ? next + 2 : next]);
+
+        endScope();
+    }
+
+    // a local of an enclosing function is captured by the lambdas
+    // in between (not through a def, which can't capture)
+    void capture(uint32_t slot) {
+        for (auto depth = functions_.size(); depth > slotDepths_[slot]; depth--) {
+            auto lambdaExp = functions_[depth - 1];
+            if (lambdaExp == nullptr) {
+                return;
+            }
+
+            auto& captures = captures_[lambdaExp];
+            if (std::find(captures.begin(), captures.end(), slot) == captures.end()) {
+                captures.push_back(slot);
+            }
+        }
+    }
+
+    // whether a slot is captured by the current function
+    bool isCapture(uint32_t slot) {
+        return !functions_.empty() && functions_.back() != nullptr &&
+               slotDepths_[slot] < functions_.size();
+    }
+
+    // methods are defined up front as <class>_<method>,
+    // then the body is resolved as a class body
+    void resolveClass(const Exp& clsExp) {
+        auto className = std::string(clsExp.list[1].string());
+        const auto& body = clsExp.list[3];
+
+        for (auto i = 1; i < body.list.size(); i++) {
+            const auto& exp = body.list[i];
+            if (isTaggedList(exp, KW_DEF)) {
+                auto methodName = className + "_" + std::string(exp.list[1].string());
+                exp.list[1].slot = define(intern(methodName));
+            }
+        }
+
+        auto prevInClass = inClass_;
+        inClass_ = true;
+        resolve(body);
+        inClass_ = prevInClass;
+    }
+
+    bool isTaggedList(const Exp& exp, SymbolId tag) {
+        return exp.type == ExpType::LIST && exp.list[0].type == ExpType::SYMBOL &&
+               exp.list[0].id == tag;
+    }
+
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+    static constexpr uint32_t NOT_LOCAL = UINT32_MAX;
+
+    // visible slot per symbol id
+    std::vector<uint32_t> current_;
+
+    // (name, previous slot) of the definitions in the open scopes
+    std::vector<std::pair<SymbolId, uint32_t>> shadowed_;
+
+    // start of each open scope in `shadowed_`
+    std::vector<size_t> scopes_;
+
+    // allocated slots
+    uint32_t slotsCount_ = 0;
+
+    // function nesting depth of the locals, by slot (0: main),
+    // NOT_LOCAL for the functions and globals
+    std::vector<uint32_t> slotDepths_;
+
+    // enclosing functions: the lambda, or null for a def
+    std::vector<const Exp*> functions_;
+
+    // captured slots per lambda
+    std::unordered_map<const Exp*, std::vector<uint32_t>> captures_;
+
+    // resolving a class body
+    bool inClass_ = false;
+};
+
+#endif
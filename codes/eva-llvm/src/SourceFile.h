@@ -0,0 +1,72 @@
+/*
+    Source file: read-only memory mapping of an input file.
+*/
+#ifndef SourceFile_h
+#define SourceFile_h
+
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./Logger.h"
+
+class SourceFile {
+public:
+    // maps the whole file read-only, the lexer and parser work on the mapping directly
+    explicit SourceFile(const std::string& fileName) {
+        int fd = open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            DIE << "Cannot open file \"" << fileName << "\"." << std::endl;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            DIE << "Cannot read file \"" << fileName << "\"." << std::endl;
+        }
+
+        size_ = st.st_size;
+
+        // empty files can't be mapped
+        if (size_ > 0) {
+            data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data_ == MAP_FAILED) {
+                close(fd);
+                DIE << "Cannot map file \"" << fileName << "\"." << std::endl;
+            }
+
+            // the source is scanned once from the beginning to the end
+            madvise(data_, size_, MADV_SEQUENTIAL);
+        }
+
+        // the mapping stays valid after closing the descriptor
+        close(fd);
+    }
+
+    ~SourceFile() {
+        if (data_ != nullptr) {
+            munmap(data_, size_);
+        }
+    }
+
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    // the file contents
+    std::string_view text() const {
+        return std::string_view(static_cast<const char*>(data_), size_);
+    }
+
+private:
+    // mapped memory
+    void* data_ = nullptr;
+
+    // size of the file in bytes
+    size_t size_ = 0;
+};
+
+#endif
@@ -1,116 +1,40 @@
 /**
- * LR parser for C++ generated by the Syntax tool.
+ * Eva parser: S-expression reader.
  *
- * https://www.npmjs.com/package/syntax-cli
- *
- *   npm install -g syntax-cli
- *
- *   syntax-cli --help
- *
- * To regenerate run:
- *
- *   syntax-cli \
- *     --grammar ~/path-to-grammar-file \
- *     --mode <parsing-mode> \
- *     --output ~/ParserClassName.h
+ * Originally an LALR(1) parser generated by the Syntax tool
+ * (https://www.npmjs.com/package/syntax-cli) from EvaGrammar.bnf.
+ * The grammar is just S-expressions, so both the tokenizer and the
+ * parser are now hand-written: a DFA scanner and an iterative reader
+ * with an explicit stack, producing the same Exp trees and errors.
  */
 #ifndef __Syntax_LR_Parser_h
 #define __Syntax_LR_Parser_h
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wunused-private-field"
-
-#include <assert.h>
+#include <algorithm>
 #include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
-#include <map>
-#include <memory>
-#include <regex>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
-// ------------------------------------
-// Module include prologue.
-//
-// Should include at least value/result type:
-//
-// type Value = <...>;
-//
-// Or struct Value { ... };
-//
-// Can also include parsing hooks:
-//
-//   void onParseBegin(const Parser& parser, const std::string& str) {
-//     ...
-//   }
-//
-//   void onParseBegin(const Parser& parser, const Value& result) {
-//     ...
-//   }
-//
-// clang-format off
-#include <string>
-#include <vector>
-
-/**
- * Expression type.
- */
-enum class ExpType {
-  NUMBER,
-  STRING,
-  SYMBOL,
-  LIST,
-};
-
-/**
- * Expression.
- */
-struct Exp {
-  ExpType type;
-
-  int number;
-  std::string string;
-  std::vector<Exp> list;
-
-  // Numbers:
-  Exp(int number) : type(ExpType::NUMBER), number(number) {}
-
-  // Strings, Symbols:
-  Exp(std::string& strVal) {
-    if (strVal[0] == '"') {
-      type = ExpType::STRING;
-      string = strVal.substr(1, strVal.size() - 2);
-    } else {
-      type = ExpType::SYMBOL;
-      string = strVal;
-    }
-  }
+#include "./Exp.h"
 
-  // Lists:
-  Exp(std::vector<Exp> list) : type(ExpType::LIST), list(list) {}
-
-};
-
-using Value = Exp;  // clang-format on
+using Value = Exp;
 
 namespace syntax {
 
 /**
  * Tokenizer class.
  */
-// clang-format off
-/**
- * Generic tokenizer used by the parser in the Syntax tool.
- *
- * https://www.npmjs.com/package/syntax-cli
- */
 
 #ifndef __Syntax_Tokenizer_h
 #define __Syntax_Tokenizer_h
 
-class Tokenizer;
-
 // ------------------------------------------------------------------
 // TokenType.
 
@@ -120,46 +44,35 @@ enum class TokenType {
   NUMBER = 4,
   STRING = 5,
   SYMBOL = 6,
-  TOKEN_TYPE_7 = 7,
-  TOKEN_TYPE_8 = 8,
-  __EOF = 9
+  LPAREN = 7,
+  RPAREN = 8,
+  __EOF = 9,
+  FLOAT = 10
   // clang-format on
 };
 
 // ------------------------------------------------------------------
 // Token.
 
+/**
+ * Tokens are small values: a span into the source buffer.
+ * The text is materialized only when the AST needs it, see
+ * Tokenizer::text, and the line/column only when a diagnostic
+ * needs it, see Tokenizer::location.
+ */
 struct Token {
   TokenType type;
-  std::string value;
-
-  int startOffset;
-  int endOffset;
-  int startLine;
-  int endLine;
-  int startColumn;
-  int endColumn;
-};
-
-using SharedToken = std::shared_ptr<Token>;
-
-typedef TokenType (*LexRuleHandler)(const Tokenizer&, const std::string&);
 
-// ------------------------------------------------------------------
-// Lex rule: [regex, handler]
-
-struct LexRule {
-  std::regex regex;
-  LexRuleHandler handler;
+  uint32_t offset;
+  uint32_t length;
 };
 
-// ------------------------------------------------------------------
-// Token.
-
-enum TokenizerState {
-  // clang-format off
-  INITIAL
-  // clang-format on
+/**
+ * Line (1-based) and column (0-based) of a source offset.
+ */
+struct SourceLocation {
+  int line;
+  int column;
 };
 
 // ------------------------------------------------------------------
@@ -170,24 +83,16 @@ class Tokenizer {
   /**
    * Initializes a parsing string.
    */
-  void initString(const std::string& str) {
+  void initString(std::string_view str) {
     str_ = str;
 
-    // Initialize states.
-    states_.clear();
-    states_.push_back(TokenizerState::INITIAL);
-
     cursor_ = 0;
-    currentLine_ = 1;
-    currentColumn_ = 0;
-    currentLineBeginOffset_ = 0;
 
     tokenStartOffset_ = 0;
     tokenEndOffset_ = 0;
-    tokenStartLine_ = 0;
-    tokenEndLine_ = 0;
-    tokenStartColumn_ = 0;
-    tokenEndColumn_ = 0;
+
+    // Built on the first diagnostic.
+    lineOffsets_.clear();
   }
 
   /**
@@ -196,94 +101,160 @@ class Tokenizer {
   inline bool hasMoreTokens() { return cursor_ <= str_.length(); }
 
   /**
-   * Returns current tokenizing state.
+   * Returns next token.
+   *
+   * Hand-written DFA scanner working directly on the source buffer.
+   * Recognizes the same token classes as the lexical grammar in
+   * EvaGrammar.bnf, trying them in the same order, so the result
+   * is identical to the regex rules, but in linear time.
    */
-  TokenizerState getCurrentState() { return states_.back(); }
+  Token getNextToken() {
+    for (;;) {
+      if (!hasMoreTokens()) {
+        return toToken(TokenType::__EOF);
+      }
+
+      if (isEOF()) {
+        cursor_++;
+        return toToken(TokenType::__EOF);
+      }
+
+      tokenStartOffset_ = cursor_;
+      auto tokenType = scanToken_();
+      tokenEndOffset_ = cursor_;
+
+      // Whitespace and comments.
+      if (tokenType == TokenType::__EMPTY) {
+        continue;
+      }
+
+      return toToken(tokenType);
+    }
+  }
 
   /**
-   * Enters a new state pushing it on the states stack.
+   * Whether the cursor is at the EOF.
    */
-  void pushState(TokenizerState state) { states_.push_back(state); }
+  inline bool isEOF() { return cursor_ == str_.length(); }
+
+  Token toToken(TokenType tokenType) {
+    if (tokenType == TokenType::__EOF) {
+      return Token{tokenType, (uint32_t)str_.length(), 0};
+    }
+
+    return Token{tokenType, (uint32_t)tokenStartOffset_,
+                 (uint32_t)(tokenEndOffset_ - tokenStartOffset_)};
+  }
 
   /**
-   * Alias for `push_state`.
+   * Integer value of a NUMBER token.
    */
-  void begin(TokenizerState state) { states_.push_back(state); }
+  int64_t toInt(const Token& token) {
+    auto text = this->text(token);
+    int64_t value = 0;
+    auto [end, err] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (err != std::errc()) {
+      throwUnexpectedToken(text, token.offset);
+    }
+    return value;
+  }
 
   /**
-   * Exits a current state popping it from the states stack.
+   * Value of a FLOAT token.
    */
-  TokenizerState popState() {
-    auto state = states_.back();
-    states_.pop_back();
-    return state;
+  double toDouble(const Token& token) const {
+    auto text = this->text(token);
+    double value = 0;
+    std::from_chars(text.data(), text.data() + text.size(), value);
+    return value;
   }
 
   /**
-   * Returns next token.
+   * Source text of a token (a view into the tokenizing string).
    */
-  SharedToken getNextToken() {
-    if (!hasMoreTokens()) {
-      yytext = __EOF;
-      return toToken(TokenType::__EOF);
+  std::string_view text(const Token& token) const {
+    if (token.type == TokenType::__EOF) {
+      return __EOF;
     }
+    return str_.substr(token.offset, token.length);
+  }
 
-    auto strSlice = str_.substr(cursor_);
-
-    auto lexRulesForState = lexRulesByStartConditions_.at(getCurrentState());
-
-    for (const auto& ruleIndex : lexRulesForState) {
-      auto rule = lexRules_[ruleIndex];
-      std::smatch sm;
-
-      if (std::regex_search(strSlice, sm, rule.regex)) {
-        yytext = sm[0];
+  /**
+   * Value of a STRING token: the contents without the quotes,
+   * with the escapes \\n \\t \\" \\\\ \\xNN decoded.
+   *
+   * Without escapes this is a view into the source, otherwise
+   * the decoded string is written to `buffer` and viewed there.
+   */
+  std::string_view stringValue(const Token& token, std::string& buffer) {
+    auto str = str_.substr(token.offset + 1, token.length - 2);
 
-        captureLocations_(yytext);
-        cursor_ += yytext.length();
+    auto escape = str.find('\\');
+    if (escape == std::string_view::npos) {
+      return str;
+    }
 
-        // Manual handling of EOF token (the end of string). Return it
-        // as `EOF` symbol.
-        if (yytext.length() == 0) {
-          cursor_++;
-        }
+    buffer.assign(str.data(), escape);
 
-        auto tokenType = rule.handler(*this, yytext);
+    for (auto i = escape; i < str.length(); i++) {
+      if (str[i] != '\\') {
+        buffer.push_back(str[i]);
+        continue;
+      }
 
-        if (tokenType == TokenType::__EMPTY) {
-          return getNextToken();
+      // The scanner guarantees a character after the backslash.
+      auto offset = token.offset + 1 + i;
+
+      switch (str[++i]) {
+        case 'n':
+          buffer.push_back('\n');
+          break;
+        case 't':
+          buffer.push_back('\t');
+          break;
+        case '"':
+        case '\\':
+          buffer.push_back(str[i]);
+          break;
+        case 'x': {
+          // unsigned: no sign, two hex digits
+          uint8_t value = 0;
+          auto digits = str.substr(i + 1, 2);
+          auto [end, err] = std::from_chars(digits.data(),
+                                            digits.data() + digits.size(),
+                                            value, 16);
+          if (err != std::errc() || end != digits.data() + 2) {
+            throwUnexpectedToken(str.substr(i - 1, 2 + (end - digits.data())), offset);
+          }
+          buffer.push_back((char)value);
+          i += 2;
+          break;
         }
-
-        return toToken(tokenType);
+        default:
+          throwUnexpectedToken(str.substr(i - 1, 2), offset);
       }
     }
 
-    if (isEOF()) {
-      cursor_++;
-      yytext = __EOF;
-      return toToken(TokenType::__EOF);
-    }
-
-    throwUnexpectedToken(std::string(1, strSlice[0]), currentLine_,
-                         currentColumn_);
+    return buffer;
   }
 
   /**
-   * Whether the cursor is at the EOF.
+   * Line and column of a source offset.
+   *
+   * Locations are not tracked while scanning: the offsets of
+   * all line starts are collected on the first call, and a
+   * location is then a binary search in them.
    */
-  inline bool isEOF() { return cursor_ == str_.length(); }
+  SourceLocation location(uint32_t offset) {
+    if (lineOffsets_.empty()) {
+      buildLineOffsets_();
+    }
+
+    // The last line starting at or before the offset.
+    auto it = std::upper_bound(lineOffsets_.begin(), lineOffsets_.end(), offset);
+    auto line = it - lineOffsets_.begin();
 
-  SharedToken toToken(TokenType tokenType) {
-    return std::shared_ptr<Token>(new Token{
-        .type = tokenType,
-        .value = yytext,
-        .startOffset = tokenStartOffset_,
-        .endOffset = tokenEndOffset_,
-        .startLine = tokenStartLine_,
-        .endLine = tokenEndLine_,
-        .startColumn = tokenStartColumn_,
-        .endColumn = tokenEndColumn_,
-    });
+    return SourceLocation{(int)line, (int)(offset - *(it - 1))};
   }
 
   /**
@@ -291,15 +262,13 @@ class Tokenizer {
    * line from the source, pointing with the ^ marker to the bad token.
    * In addition, shows `line:column` location.
    */
-  [[noreturn]] void throwUnexpectedToken(const std::string& symbol, int line,
-                                         int column) {
-    std::stringstream ss{str_};
-    std::string lineStr;
-    int currentLine = 1;
+  [[noreturn]] void throwUnexpectedToken(std::string_view symbol,
+                                         uint32_t offset) {
+    auto [line, column] = location(offset);
 
-    while (currentLine++ <= line) {
-      std::getline(ss, lineStr, '\n');
-    }
+    // The line in the source.
+    auto lineBegin = lineOffsets_[line - 1];
+    auto lineStr = str_.substr(lineBegin, str_.find('\n', lineBegin) - lineBegin);
 
     auto pad = std::string(column, ' ');
 
@@ -314,223 +283,223 @@ class Tokenizer {
     throw new std::runtime_error(errMsg.str().c_str());
   }
 
-  /**
-   * Matched text.
-   */
-  std::string yytext;
-
  private:
   /**
-   * Captures token locations.
+   * Collects the offsets of all line starts. memchr is
+   * vectorized by libc, so this runs at memory bandwidth.
    */
-  void captureLocations_(const std::string& matched) {
-    auto len = matched.length();
+  void buildLineOffsets_() {
+    lineOffsets_.push_back(0);
 
-    // Absolute offsets.
-    tokenStartOffset_ = cursor_;
+    auto begin = str_.data();
+    auto end = begin + str_.length();
 
-    // Line-based locations, start.
-    tokenStartLine_ = currentLine_;
-    tokenStartColumn_ = tokenStartOffset_ - currentLineBeginOffset_;
-
-    // Extract `\n` in the matched token.
-    std::stringstream ss{matched};
-    std::string lineStr;
-    std::getline(ss, lineStr, '\n');
-    while (ss.tellg() > 0 && ss.tellg() <= len) {
-      currentLine_++;
-      currentLineBeginOffset_ = tokenStartOffset_ + ss.tellg();
-      std::getline(ss, lineStr, '\n');
+    for (auto p = begin; p < end; p++) {
+      p = static_cast<const char*>(std::memchr(p, '\n', end - p));
+      if (p == nullptr) {
+        break;
+      }
+      lineOffsets_.push_back(p - begin + 1);
     }
-
-    tokenEndOffset_ = cursor_ + len;
-
-    // Line-based locations, end.
-    tokenEndLine_ = currentLine_;
-    tokenEndColumn_ = tokenEndOffset_ - currentLineBeginOffset_;
-    currentColumn_ = tokenEndColumn_;
   }
 
   /**
-   * Lexical rules.
+   * Character classes of the scanner DFA.
    */
-  // clang-format off
-  static constexpr size_t LEX_RULES_COUNT = 8;
-  static std::array<LexRule, LEX_RULES_COUNT> lexRules_;
-  static std::map<TokenizerState, std::vector<size_t>> lexRulesByStartConditions_;
-  // clang-format on
+  enum CharClass : uint8_t {
+    CC_OTHER = 0,
+    CC_SPACE = 1 << 0,   // \s
+    CC_DIGIT = 1 << 1,   // \d
+    CC_SYMBOL = 1 << 2,  // [\w\-+*=!<>/:]
+  };
 
   /**
-   * Special EOF token.
+   * Builds the character class table.
    */
-  static std::string __EOF;
+  static std::array<uint8_t, 256> buildCharClasses_() {
+    std::array<uint8_t, 256> table{};
 
-  /**
-   * Tokenizing string.
-   */
-  std::string str_;
+    for (auto c : {' ', '\t', '\n', '\v', '\f', '\r'}) {
+      table[(uint8_t)c] |= CC_SPACE;
+    }
 
-  /**
-   * Cursor for current symbol.
-   */
-  int cursor_;
+    for (auto c = '0'; c <= '9'; c++) {
+      table[(uint8_t)c] |= CC_DIGIT | CC_SYMBOL;
+    }
+
+    for (auto c = 'a'; c <= 'z'; c++) {
+      table[(uint8_t)c] |= CC_SYMBOL;
+      table[(uint8_t)(c - 'a' + 'A')] |= CC_SYMBOL;
+    }
+
+    for (auto c : {'_', '-', '+', '*', '=', '!', '<', '>', '/', ':'}) {
+      table[(uint8_t)c] |= CC_SYMBOL;
+    }
+
+    return table;
+  }
 
   /**
-   * States.
+   * Character class lookup.
    */
-  std::vector<TokenizerState> states_;
+  static inline bool is_(char c, CharClass cls) {
+    return (charClasses_[(uint8_t)c] & cls) != 0;
+  }
 
   /**
-   * Line-based location tracking.
+   * Advances the cursor while the current character is of given class.
    */
-  int currentLine_;
-  int currentColumn_;
-  int currentLineBeginOffset_;
+  inline void skipWhile_(CharClass cls) {
+    int length = str_.length();
+    while (cursor_ < length && is_(str_[cursor_], cls)) {
+      cursor_++;
+    }
+  }
 
   /**
-   * Location data of a matched token.
+   * Scans one token starting at the cursor, and moves the cursor
+   * past it. Returns __EMPTY for whitespace and comments.
    */
-  int tokenStartOffset_;
-  int tokenEndOffset_;
-  int tokenStartLine_;
-  int tokenEndLine_;
-  int tokenStartColumn_;
-  int tokenEndColumn_;
-};
+  TokenType scanToken_() {
+    int length = str_.length();
+    auto c = str_[cursor_];
+    auto next = cursor_ + 1 < length ? str_[cursor_ + 1] : '\0';
 
-// ------------------------------------------------------------------
-// Lexical rule handlers.
+    // '(' and ')'
+    if (c == '(') {
+      cursor_++;
+      return TokenType::LPAREN;
+    }
 
-std::string Tokenizer::__EOF("$");
+    if (c == ')') {
+      cursor_++;
+      return TokenType::RPAREN;
+    }
 
-// clang-format off
-inline TokenType _lexRule1(const Tokenizer& tokenizer, const std::string& yytext) {
-return TokenType::TOKEN_TYPE_7;
-}
+    // \/\/.*
+    if (c == '/' && next == '/') {
+      while (cursor_ < length && str_[cursor_] != '\n' && str_[cursor_] != '\r') {
+        cursor_++;
+      }
+      return TokenType::__EMPTY;
+    }
 
-inline TokenType _lexRule2(const Tokenizer& tokenizer, const std::string& yytext) {
-return TokenType::TOKEN_TYPE_8;
-}
+    // \/\*[\s\S]*?\*\/ -- an unterminated comment falls through to SYMBOL.
+    if (c == '/' && next == '*') {
+      auto close = str_.find("*/", cursor_ + 2);
+      if (close != std::string::npos) {
+        cursor_ = close + 2;
+        return TokenType::__EMPTY;
+      }
+    }
 
-inline TokenType _lexRule3(const Tokenizer& tokenizer, const std::string& yytext) {
-return TokenType::__EMPTY;
-}
+    // \s+
+    if (is_(c, CC_SPACE)) {
+      skipWhile_(CC_SPACE);
+      return TokenType::__EMPTY;
+    }
 
-inline TokenType _lexRule4(const Tokenizer& tokenizer, const std::string& yytext) {
-return TokenType::__EMPTY;
-}
+    // "(\\.|[^"\\])*"
+    if (c == '"') {
+      for (auto i = cursor_ + 1; i < length; i++) {
+        if (str_[i] == '\\') {
+          i++;
+        } else if (str_[i] == '"') {
+          cursor_ = i + 1;
+          return TokenType::STRING;
+        }
+      }
+    }
 
-inline TokenType _lexRule5(const Tokenizer& tokenizer, const std::string& yytext) {
-return TokenType::__EMPTY;
-}
+    // \d+\.\d+ and \d+
+    if (is_(c, CC_DIGIT)) {
+      skipWhile_(CC_DIGIT);
 
-inline TokenType _lexRule6(const Tokenizer& tokenizer, const std::string& yytext) {
-return TokenType::STRING;
-}
+      if (cursor_ + 1 < length && str_[cursor_] == '.' && is_(str_[cursor_ + 1], CC_DIGIT)) {
+        cursor_++;
+        skipWhile_(CC_DIGIT);
+        return TokenType::FLOAT;
+      }
 
-inline TokenType _lexRule7(const Tokenizer& tokenizer, const std::string& yytext) {
-return TokenType::NUMBER;
-}
+      return TokenType::NUMBER;
+    }
 
-inline TokenType _lexRule8(const Tokenizer& tokenizer, const std::string& yytext) {
-return TokenType::SYMBOL;
-}
-// clang-format on
+    // [\w\-+*=!<>/:]+
+    if (is_(c, CC_SYMBOL)) {
+      skipWhile_(CC_SYMBOL);
+      return TokenType::SYMBOL;
+    }
 
-// ------------------------------------------------------------------
-// Lexical rules.
-
-// clang-format off
-std::array<LexRule, Tokenizer::LEX_RULES_COUNT> Tokenizer::lexRules_ = {{
-  {std::regex(R"(^\()"), &_lexRule1},
-  {std::regex(R"(^\))"), &_lexRule2},
-  {std::regex(R"(^\/\/.*)"), &_lexRule3},
-  {std::regex(R"(^\/\*[\s\S]*?\*\/)"), &_lexRule4},
-  {std::regex(R"(^\s+)"), &_lexRule5},
-  {std::regex(R"(^"[^\"]*")"), &_lexRule6},
-  {std::regex(R"(^\d+)"), &_lexRule7},
-  {std::regex(R"(^[\w\-+*=!<>/]+)"), &_lexRule8}
-}};
-std::map<TokenizerState, std::vector<size_t>> Tokenizer::lexRulesByStartConditions_ =  {{TokenizerState::INITIAL, {0, 1, 2, 3, 4, 5, 6, 7}}};
-// clang-format on
+    throwUnexpectedToken(std::string(1, c), cursor_);
+  }
 
-#endif
-// clang-format on
+  /**
+   * Character classes of all bytes.
+   */
+  static std::array<uint8_t, 256> charClasses_;
 
-#define POP_V()              \
-  parser.valuesStack.back(); \
-  parser.valuesStack.pop_back()
+  /**
+   * Special EOF token.
+   */
+  static std::string __EOF;
 
-#define POP_T()              \
-  parser.tokensStack.back(); \
-  parser.tokensStack.pop_back()
+  /**
+   * Tokenizing string: a view of the source buffer,
+   * which is owned by the caller.
+   */
+  std::string_view str_;
 
-#define PUSH_VR() parser.valuesStack.push_back(__)
-#define PUSH_TR() parser.tokensStack.push_back(__)
+  /**
+   * Cursor for current symbol.
+   */
+  int cursor_;
 
-/**
- * Parsing table type.
- */
-enum class TE {
-  Accept,
-  Shift,
-  Reduce,
-  Transit,
-};
+  /**
+   * Offsets of the line starts, built lazily by `location`.
+   */
+  std::vector<uint32_t> lineOffsets_;
 
-/**
- * Parsing table entry.
- */
-struct TableEntry {
-  TE type;
-  int value;
+  /**
+   * Offsets of a matched token.
+   */
+  int tokenStartOffset_;
+  int tokenEndOffset_;
 };
 
-// clang-format off
-class EvaParser;
-// clang-format on
-
-using yyparse = EvaParser;
+// ------------------------------------------------------------------
+// Scanner tables.
 
-typedef void (*ProductionHandler)(yyparse&);
+std::string Tokenizer::__EOF("$");
 
-/**
- * Encoded production.
- *
- * opcode - encoded index
- * rhsLength - length of the RHS to pop.
- */
-struct Production {
-  int opcode;
-  int rhsLength;
-  ProductionHandler handler;
-};
+std::array<uint8_t, 256> Tokenizer::charClasses_ = Tokenizer::buildCharClasses_();
 
-// Key: Encoded symbol (terminal or non-terminal) index
-// Value: TableEntry
-using Row = std::map<int, TableEntry>;
+#endif
 
 /**
  * Parser class.
+ *
+ * Reads S-expressions iteratively: open lists are kept on an
+ * explicit stack (no recursion), and the entries of every open
+ * list on the listEntries stack, until its ')' moves them into
+ * the arena in one go.
  */
-// clang-format off
 class EvaParser {
-  // clang-format on
  public:
   /**
-   * Parsing values stack.
+   * Children of the lists being parsed. A closed list moves
+   * its entries from the top of this stack into the arena.
    */
-  std::vector<Value> valuesStack;
+  std::vector<Exp> listEntries;
 
   /**
-   * Token values stack.
+   * Start indices (in listEntries) of the open lists.
    */
-  std::vector<std::string> tokensStack;
+  std::vector<uint32_t> openLists;
 
   /**
-   * Parsing states stack.
+   * AST storage.
    */
-  std::vector<int> statesStack;
+  ExpArena arena;
 
   /**
    * Tokenizer.
@@ -538,267 +507,180 @@ class EvaParser {
   Tokenizer tokenizer;
 
   /**
-   * Previous state to calculate the next one.
+   * Frees the AST of the last parse.
    */
-  int previousState;
+  void reset() { arena.reset(); }
 
   /**
-   * Parses a string.
+   * Parses a string with a single expression.
+   *
+   * The source is not copied: the AST refers to it,
+   * so it should outlive the AST.
    */
-  Value parse(const std::string& str) {
-    // clang-format off
-    
-    // clang-format on
+  Value parse(std::string_view str) {
+    init_(str);
 
-    // Initialize the tokenizer and the string.
-    tokenizer.initString(str);
+    auto result = readExp_();
 
-    // Initialize the stacks.
-    valuesStack.clear();
-    tokensStack.clear();
-    statesStack.clear();
+    // Only one expression is expected.
+    if (lookahead_.type != TokenType::__EOF) {
+      throwUnexpectedToken(lookahead_);
+    }
 
-    // Initial 0 state.
-    statesStack.push_back(0);
+    return result;
+  }
 
-    auto token = tokenizer.getNextToken();
-    auto shiftedToken = token;
+  /**
+   * Parses a program: a sequence of top-level forms,
+   * returned as an implicit (begin <forms>) block.
+   */
+  Value parseProgram(std::string_view str) {
+    init_(str);
 
-    // Main parsing loop.
-    for (;;) {
-      auto state = statesStack.back();
-      auto column = (int)token->type;
+    // The top-level forms are the bottom entries of the
+    // listEntries stack, nested lists are built above them.
+    listEntries.push_back(Exp(std::string_view("begin")));
 
-      if (table_[state].count(column) == 0) {
-        throwUnexpectedToken(token);
-      }
+    while (lookahead_.type != TokenType::__EOF) {
+      auto form = readExp_();
+      listEntries.push_back(form);
+    }
 
-      auto entry = table_[state].at(column);
+    auto program = Exp(arena.makeList(listEntries.data(), listEntries.size()));
+    listEntries.clear();
 
-      // Shift a token, go to state.
-      if (entry.type == TE::Shift) {
-        // Push token.
-        tokensStack.push_back(token->value);
+    return program;
+  }
 
-        // Push next state number: "s5" -> 5
-        statesStack.push_back(entry.value);
+  /**
+   * Streaming parse: starts a program, the top-level
+   * forms are then read one by one with `parseNextForm`.
+   */
+  void beginProgram(std::string_view str) { init_(str); }
 
-        shiftedToken = token;
-        token = tokenizer.getNextToken();
-      }
+  /**
+   * Whether there are still top-level forms to read.
+   */
+  bool hasMoreForms() { return lookahead_.type != TokenType::__EOF; }
 
-      // Reduce by production.
-      else if (entry.type == TE::Reduce) {
-        auto productionNumber = entry.value;
-        auto production = productions_[productionNumber];
+  /**
+   * Parses the next top-level form. The previous form's AST
+   * is freed, so memory is bounded by the largest form.
+   */
+  Value parseNextForm() {
+    arena.reset();
+    return readExp_();
+  }
 
-        tokenizer.yytext = shiftedToken->value;
+ private:
+  /**
+   * Initializes the tokenizer and the stacks.
+   */
+  void init_(std::string_view str) {
+    tokenizer.initString(str);
 
-        auto rhsLength = production.rhsLength;
-        while (rhsLength > 0) {
-          statesStack.pop_back();
-          rhsLength--;
-        }
+    listEntries.clear();
+    openLists.clear();
 
-        // Call the handler.
-        production.handler(*this);
+    // Free the previous AST.
+    arena.reset();
 
-        auto previousState = statesStack.back();
+    lookahead_ = tokenizer.getNextToken();
+  }
 
-        auto symbolToReduceWith = production.opcode;
-        auto nextStateEntry = table_[previousState].at(symbolToReduceWith);
-        assert(nextStateEntry.type == TE::Transit);
+  /**
+   * Reads one expression starting at the lookahead token.
+   */
+  Value readExp_() {
+    for (;;) {
+      auto token = lookahead_;
+      Exp exp;
+
+      switch (token.type) {
+        // Open a list: its entries start at the top of listEntries.
+        case TokenType::LPAREN:
+          openLists.push_back(listEntries.size());
+          lookahead_ = tokenizer.getNextToken();
+          continue;
+
+        // Close the innermost list.
+        case TokenType::RPAREN: {
+          if (openLists.empty()) {
+            throwUnexpectedToken(token);
+          }
+
+          auto start = openLists.back();
+          openLists.pop_back();
+
+          exp = Exp(arena.makeList(listEntries.data() + start,
+                                   listEntries.size() - start));
+          listEntries.resize(start);
+          break;
+        }
 
-        statesStack.push_back(nextStateEntry.value);
-      }
+        // Atoms.
+        case TokenType::NUMBER:
+          exp = Exp(tokenizer.toInt(token));
+          break;
 
-      // Accept the string.
-      else if (entry.type == TE::Accept) {
-        // Pop state number.
-        statesStack.pop_back();
+        case TokenType::FLOAT:
+          exp = Exp::makeFloat(tokenizer.toDouble(token));
+          break;
 
-        // Pop the parsed value.
-        // clang-format off
-        auto result = valuesStack.back(); valuesStack.pop_back();
-        // clang-format on
+        case TokenType::STRING: {
+          auto str = tokenizer.stringValue(token, stringBuffer_);
 
-        if (statesStack.size() != 1 || statesStack.back() != 0 ||
-            tokenizer.hasMoreTokens()) {
-          throwUnexpectedToken(token);
+          // Decoded strings are copied out of the buffer.
+          if (str.data() == stringBuffer_.data()) {
+            str = arena.makeString(str);
+          }
+
+          exp = Exp::makeString(str);
+          break;
         }
 
-        statesStack.pop_back();
+        case TokenType::SYMBOL:
+          exp = Exp(tokenizer.text(token));
+          break;
+
+        default:
+          throwUnexpectedToken(token);
+      }
 
-        // clang-format off
-        
-        // clang-format on
+      lookahead_ = tokenizer.getNextToken();
 
-        return result;
+      // A complete expression.
+      if (openLists.empty()) {
+        return exp;
       }
+
+      listEntries.push_back(exp);
     }
   }
 
- private:
   /**
    * Throws parser error on unexpected token.
    */
-  [[noreturn]] void throwUnexpectedToken(SharedToken token) {
-    if (token->type == TokenType::__EOF && !tokenizer.hasMoreTokens()) {
+  [[noreturn]] void throwUnexpectedToken(const Token& token) {
+    if (token.type == TokenType::__EOF && !tokenizer.hasMoreTokens()) {
       std::string errMsg = "Unexpected end of input.\n";
       std::cerr << errMsg;
       throw std::runtime_error(errMsg.c_str());
     }
-    tokenizer.throwUnexpectedToken(token->value, token->startLine,
-                                   token->startColumn);
+    tokenizer.throwUnexpectedToken(tokenizer.text(token), token.offset);
   }
 
-  // clang-format off
-  static constexpr size_t PRODUCTIONS_COUNT = 9;
-  static std::array<Production, PRODUCTIONS_COUNT> productions_;
-
-  static constexpr size_t ROWS_COUNT = 11;
-  static std::array<Row, ROWS_COUNT> table_;
-  // clang-format on
-};
-
-// ------------------------------------------------------------------
-// Productions.
-
-// clang-format off
-void _handler1(yyparse& parser) {
-// Semantic action prologue.
-auto _1 = POP_V();
-
-auto __ = _1;
-
- // Semantic action epilogue.
-PUSH_VR();
-
-}
-
-void _handler2(yyparse& parser) {
-// Semantic action prologue.
-auto _1 = POP_V();
-
-auto __ = _1;
-
- // Semantic action epilogue.
-PUSH_VR();
-
-}
-
-void _handler3(yyparse& parser) {
-// Semantic action prologue.
-auto _1 = POP_V();
-
-auto __ = _1;
-
- // Semantic action epilogue.
-PUSH_VR();
-
-}
-
-void _handler4(yyparse& parser) {
-// Semantic action prologue.
-auto _1 = POP_T();
-
-auto __ = Exp(std::stoi(_1)) ;
-
- // Semantic action epilogue.
-PUSH_VR();
-
-}
-
-void _handler5(yyparse& parser) {
-// Semantic action prologue.
-auto _1 = POP_T();
-
-auto __ = Exp(_1) ;
-
- // Semantic action epilogue.
-PUSH_VR();
-
-}
-
-void _handler6(yyparse& parser) {
-// Semantic action prologue.
-auto _1 = POP_T();
-
-auto __ = Exp(_1) ;
-
- // Semantic action epilogue.
-PUSH_VR();
-
-}
-
-void _handler7(yyparse& parser) {
-// Semantic action prologue.
-parser.tokensStack.pop_back();
-auto _2 = POP_V();
-parser.tokensStack.pop_back();
-
-auto __ = _2 ;
-
- // Semantic action epilogue.
-PUSH_VR();
-
-}
-
-void _handler8(yyparse& parser) {
-// Semantic action prologue.
-
-
-auto __ = Exp(std::vector<Exp>{}) ;
-
- // Semantic action epilogue.
-PUSH_VR();
-
-}
-
-void _handler9(yyparse& parser) {
-// Semantic action prologue.
-auto _2 = POP_V();
-auto _1 = POP_V();
-
-_1.list.push_back(_2); auto __ = _1 ;
-
- // Semantic action epilogue.
-PUSH_VR();
-
-}
-// clang-format on
-
-// clang-format off
-std::array<Production, yyparse::PRODUCTIONS_COUNT> yyparse::productions_ = {{{-1, 1, &_handler1},
-{0, 1, &_handler2},
-{0, 1, &_handler3},
-{1, 1, &_handler4},
-{1, 1, &_handler5},
-{1, 1, &_handler6},
-{2, 3, &_handler7},
-{3, 0, &_handler8},
-{3, 2, &_handler9}}};
-// clang-format on
+  /**
+   * Lookahead token.
+   */
+  Token lookahead_;
 
-// ------------------------------------------------------------------
-// Parsing table.
-
-// clang-format off
-std::array<Row, yyparse::ROWS_COUNT> yyparse::table_ = {
-    Row {{0, {TE::Transit, 1}}, {1, {TE::Transit, 2}}, {2, {TE::Transit, 3}}, {4, {TE::Shift, 4}}, {5, {TE::Shift, 5}}, {6, {TE::Shift, 6}}, {7, {TE::Shift, 7}}},
-    Row {{9, {TE::Accept, 0}}},
-    Row {{4, {TE::Reduce, 1}}, {5, {TE::Reduce, 1}}, {6, {TE::Reduce, 1}}, {7, {TE::Reduce, 1}}, {8, {TE::Reduce, 1}}, {9, {TE::Reduce, 1}}},
-    Row {{4, {TE::Reduce, 2}}, {5, {TE::Reduce, 2}}, {6, {TE::Reduce, 2}}, {7, {TE::Reduce, 2}}, {8, {TE::Reduce, 2}}, {9, {TE::Reduce, 2}}},
-    Row {{4, {TE::Reduce, 3}}, {5, {TE::Reduce, 3}}, {6, {TE::Reduce, 3}}, {7, {TE::Reduce, 3}}, {8, {TE::Reduce, 3}}, {9, {TE::Reduce, 3}}},
-    Row {{4, {TE::Reduce, 4}}, {5, {TE::Reduce, 4}}, {6, {TE::Reduce, 4}}, {7, {TE::Reduce, 4}}, {8, {TE::Reduce, 4}}, {9, {TE::Reduce, 4}}},
-    Row {{4, {TE::Reduce, 5}}, {5, {TE::Reduce, 5}}, {6, {TE::Reduce, 5}}, {7, {TE::Reduce, 5}}, {8, {TE::Reduce, 5}}, {9, {TE::Reduce, 5}}},
-    Row {{3, {TE::Transit, 8}}, {4, {TE::Reduce, 7}}, {5, {TE::Reduce, 7}}, {6, {TE::Reduce, 7}}, {7, {TE::Reduce, 7}}, {8, {TE::Reduce, 7}}},
-    Row {{0, {TE::Transit, 10}}, {1, {TE::Transit, 2}}, {2, {TE::Transit, 3}}, {4, {TE::Shift, 4}}, {5, {TE::Shift, 5}}, {6, {TE::Shift, 6}}, {7, {TE::Shift, 7}}, {8, {TE::Shift, 9}}},
-    Row {{4, {TE::Reduce, 6}}, {5, {TE::Reduce, 6}}, {6, {TE::Reduce, 6}}, {7, {TE::Reduce, 6}}, {8, {TE::Reduce, 6}}, {9, {TE::Reduce, 6}}},
-    Row {{4, {TE::Reduce, 8}}, {5, {TE::Reduce, 8}}, {6, {TE::Reduce, 8}}, {7, {TE::Reduce, 8}}, {8, {TE::Reduce, 8}}}
+  /**
+   * Scratch buffer for decoding string escapes.
+   */
+  std::string stringBuffer_;
 };
-// clang-format on
 
 }  // namespace syntax
 
-#endif
\ No newline at end of file
+#endif
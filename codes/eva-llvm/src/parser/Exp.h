@@ -0,0 +1,214 @@
+/*
+    Eva AST: compact expression nodes allocated in an arena.
+*/
+#ifndef Exp_h
+#define Exp_h
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "./Symbol.h"
+
+struct Exp;
+
+/**
+ * Expression type.
+ */
+enum class ExpType : uint8_t {
+  NUMBER,
+  FLOAT,
+  STRING,
+  SYMBOL,
+  LIST,
+};
+
+/**
+ * Children of a list: a contiguous range of nodes in the arena.
+ */
+struct ExpList {
+  const Exp* data_;
+  uint32_t size_;
+
+  inline const Exp& operator[](size_t index) const;
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  inline const Exp* begin() const;
+  inline const Exp* end() const;
+};
+
+/**
+ * Characters of a string literal.
+ */
+struct ExpString {
+  const char* data_;
+  uint32_t size_;
+};
+
+/**
+ * Expression.
+ *
+ * Nodes are trivially copyable and never own memory, and are 24
+ * bytes: the payload is a union keyed on the type. Strings are
+ * views into the source, children (and strings with decoded
+ * escapes) live in the ExpArena. Symbols only keep their interned
+ * id (the name is in the symbol table), and the binding slot
+ * filled in by the Resolver.
+ */
+struct Exp {
+  ExpType type;
+
+  // Binding slot of a variable reference or definition,
+  // an annotation set by the name resolution pass.
+  mutable uint32_t slot = 0;
+
+  union {
+    int64_t number;
+    double decimal;
+    SymbolId id;
+    ExpString chars;
+    ExpList list;
+  };
+
+  Exp() : type(ExpType::LIST), list{} {}
+
+  // Numbers:
+  Exp(int64_t number) : type(ExpType::NUMBER), number(number) {}
+
+  // Floating point numbers:
+  static Exp makeFloat(double decimal) {
+    Exp exp;
+    exp.type = ExpType::FLOAT;
+    exp.decimal = decimal;
+    return exp;
+  }
+
+  // Symbols:
+  Exp(std::string_view strVal) : type(ExpType::SYMBOL), id(intern(strVal)) {}
+
+  // Strings (unquoted, escapes decoded):
+  static Exp makeString(std::string_view strVal) {
+    Exp exp;
+    exp.type = ExpType::STRING;
+    exp.chars = ExpString{strVal.data(), (uint32_t)strVal.size()};
+    return exp;
+  }
+
+  // Lists:
+  Exp(ExpList list) : type(ExpType::LIST), list(list) {}
+
+  // Contents of a string, or the name of a symbol:
+  std::string_view string() const {
+    if (type == ExpType::SYMBOL) {
+      return SymbolTable::global().name(id);
+    }
+    return std::string_view(chars.data_, chars.size_);
+  }
+};
+
+static_assert(sizeof(Exp) == 24, "AST nodes are 24 bytes");
+
+const Exp& ExpList::operator[](size_t index) const { return data_[index]; }
+const Exp* ExpList::begin() const { return data_; }
+const Exp* ExpList::end() const { return data_ + size_; }
+
+/**
+ * Arena for the AST nodes.
+ *
+ * Nodes are bump-allocated in chunks and freed all at once
+ * with `reset`, there is no per-node deallocation.
+ */
+class ExpArena {
+ public:
+  /**
+   * Copies `count` nodes into contiguous arena storage
+   * and returns them as a list.
+   */
+  ExpList makeList(const Exp* nodes, size_t count) {
+    if (count == 0) {
+      return ExpList{};
+    }
+
+    auto storage = allocate(count);
+    std::copy(nodes, nodes + count, storage);
+
+    return ExpList{storage, (uint32_t)count};
+  }
+
+  /**
+   * Copies a string into arena storage.
+   */
+  std::string_view makeString(std::string_view str) {
+    strings_.push_back(std::make_unique<char[]>(str.size()));
+    std::copy(str.begin(), str.end(), strings_.back().get());
+
+    return std::string_view(strings_.back().get(), str.size());
+  }
+
+  /**
+   * Frees all nodes in one shot. One chunk is kept, so
+   * resetting after every small tree doesn't hit malloc.
+   */
+  void reset() {
+    large_.clear();
+    strings_.clear();
+    if (chunks_.size() > 1) {
+      chunks_.resize(1);
+    }
+    used_ = 0;
+  }
+
+ private:
+  /**
+   * Allocates `count` contiguous nodes.
+   */
+  Exp* allocate(size_t count) {
+    // Large lists get their own allocation, so the
+    // current chunk can still be filled up.
+    if (count > CHUNK_SIZE / 4) {
+      large_.push_back(std::make_unique<Exp[]>(count));
+      return large_.back().get();
+    }
+
+    if (chunks_.empty() || used_ + count > CHUNK_SIZE) {
+      chunks_.push_back(std::make_unique<Exp[]>(CHUNK_SIZE));
+      used_ = 0;
+    }
+
+    auto storage = chunks_.back().get() + used_;
+    used_ += count;
+
+    return storage;
+  }
+
+  /**
+   * Number of nodes per chunk.
+   */
+  static constexpr size_t CHUNK_SIZE = 4096;
+
+  /**
+   * Chunks storage, the last one is being filled.
+   */
+  std::vector<std::unique_ptr<Exp[]>> chunks_;
+
+  /**
+   * Storage of large lists.
+   */
+  std::vector<std::unique_ptr<Exp[]>> large_;
+
+  /**
+   * Storage of decoded strings.
+   */
+  std::vector<std::unique_ptr<char[]>> strings_;
+
+  /**
+   * Nodes used in the last chunk.
+   */
+  size_t used_ = 0;
+};
+
+#endif
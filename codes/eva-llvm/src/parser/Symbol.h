@@ -0,0 +1,142 @@
+/*
+    Symbol interning: every distinct symbol name gets a small
+    integer id, so the compiler compares and dispatches on ids
+    instead of strings.
+*/
+#ifndef Symbol_h
+#define Symbol_h
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using SymbolId = uint32_t;
+
+/*
+  Keywords of the language. They are interned first, in this
+  order, so their ids are the compile-time constants below.
+  Special forms are looked up in a table indexed by these ids.
+*/
+#define EVA_KEYWORDS(K)          \
+  K(ADD, "+")                    \
+  K(SUB, "-")                    \
+  K(MUL, "*")                    \
+  K(DIV, "/")                    \
+  K(GT, ">")                     \
+  K(LT, "<")                     \
+  K(EQ, "==")                    \
+  K(NE, "!=")                    \
+  K(GE, ">=")                    \
+  K(LE, "<=")                    \
+  K(IF, "if")                    \
+  K(WHILE, "while")              \
+  K(FOR, "for")                  \
+  K(BREAK, "break")              \
+  K(CONTINUE, "continue")        \
+  K(DEF, "def")                  \
+  K(LAMBDA, "lambda")            \
+  K(VAR, "var")                  \
+  K(CONST, "const")              \
+  K(SET, "set")                  \
+  K(BEGIN, "begin")              \
+  K(PRINTF, "printf")            \
+  K(CLASS, "class")              \
+  K(NEW, "new")                  \
+  K(PROP, "prop")                \
+  K(METHOD, "method")            \
+  K(SUPER, "super")              \
+  K(TRUE, "true")                \
+  K(FALSE, "false")              \
+  K(NULL_, "null")               \
+  K(SELF, "self")                \
+  K(ARROW, "->")                 \
+  K(NUMBER, "number")            \
+  K(I32, "i32")                  \
+  K(I64, "i64")                  \
+  K(F64, "f64")                  \
+  K(STRING, "string")            \
+  K(ARRAY, "array")              \
+  K(FN, "fn")                    \
+  K(CONSTRUCTOR, "constructor")  \
+  K(CALL, "__call__")            \
+  K(NEW_ARRAY, "new-array")      \
+  K(AREF, "aref")                \
+  K(ASET, "aset")                \
+  K(LEN, "len")
+
+enum Keyword : SymbolId {
+#define EVA_KEYWORD_ID(name, str) KW_##name,
+  EVA_KEYWORDS(EVA_KEYWORD_ID)
+#undef EVA_KEYWORD_ID
+  KEYWORDS_COUNT,
+};
+
+/**
+ * Global symbol interner.
+ */
+class SymbolTable {
+ public:
+  static SymbolTable& global() {
+    static SymbolTable table;
+    return table;
+  }
+
+  /**
+   * Returns the id of a name, allocating a new one on first use.
+   */
+  SymbolId intern(std::string_view name) {
+    auto it = ids_.find(name);
+    if (it != ids_.end()) {
+      return it->second;
+    }
+
+    // deque never moves its elements, so the views stay valid.
+    storage_.emplace_back(name);
+    std::string_view stored = storage_.back();
+
+    SymbolId id = names_.size();
+    names_.push_back(stored);
+    ids_.emplace(stored, id);
+
+    return id;
+  }
+
+  /**
+   * Name of an interned symbol.
+   */
+  std::string_view name(SymbolId id) const { return names_[id]; }
+
+ private:
+  SymbolTable() {
+#define EVA_KEYWORD_INTERN(name, str) intern(str);
+    EVA_KEYWORDS(EVA_KEYWORD_INTERN)
+#undef EVA_KEYWORD_INTERN
+  }
+
+  /**
+   * Names storage.
+   */
+  std::deque<std::string> storage_;
+
+  /**
+   * Id -> name.
+   */
+  std::vector<std::string_view> names_;
+
+  /**
+   * Name -> id.
+   */
+  std::unordered_map<std::string_view, SymbolId> ids_;
+};
+
+/**
+ * Interns a name in the global symbol table.
+ */
+inline SymbolId intern(std::string_view name) {
+  return SymbolTable::global().intern(name);
+}
+
+#endif
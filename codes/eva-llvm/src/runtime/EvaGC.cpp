@@ -0,0 +1,479 @@
+/*
+    Eva precise collector, linked with the programs compiled with
+    --precise-gc (instead of EvaRuntime.o and libgc):
+
+      clang++ -O2 -std=c++17 -c src/runtime/EvaGC.cpp -o ./bin/EvaGC.o
+      clang++ -no-pie ./bin/out.o ./bin/EvaGC.o -o ./bin/out
+
+    (the stack maps hold absolute addresses: not position independent)
+
+    The stack is walked with the frame pointers (x86-64), the Eva
+    functions keep them. Single-threaded, as the compiled programs.
+
+    Environment: EVA_GC_YOUNG_KB sets the size of the young generation,
+    EVA_GC_STATS prints the collections and their pauses at exit.
+*/
+#include "./EvaGC.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+
+EvaNursery eva_gc_young = {nullptr, nullptr};
+
+// the stack maps of the program (LLVM stack map format v3), the
+// compiler makes the symbol global, none without statepoints
+extern const uint8_t __LLVM_StackMaps[] __attribute__((weak));
+
+}
+
+namespace {
+
+/*
+  A contiguous space: [start, top) is allocated, [top, end) is free,
+  `mapped` bytes are reserved from `start`.
+*/
+struct Space {
+    char* start = nullptr;
+    char* top = nullptr;
+    char* end = nullptr;
+    uint64_t mapped = 0;
+
+    bool contains(const void* p) const { return p >= start && p < end; }
+    uint64_t used() const { return top - start; }
+    uint64_t free() const { return end - top; }
+};
+
+// the young generation, its top is eva_gc_young.cursor
+Space young;
+
+// the old generation
+Space old;
+
+// the space the old generation is evacuated to, by a major collection
+Space toSpace;
+
+// fields of old objects which may point to young objects
+std::vector<void**> rememberedSet;
+
+// the stack map record of each call site, by return address
+std::unordered_map<uintptr_t, const uint8_t*> callSites;
+
+struct Stats {
+    uint64_t minor = 0;
+    uint64_t major = 0;
+    double minorPause = 0;
+    double majorPause = 0;
+    double maxPause = 0;
+} stats;
+
+// stack map location kinds
+enum LocationType : uint8_t { REGISTER = 1, DIRECT = 2, INDIRECT = 3, CONSTANT = 4, CONSTANT_INDEX = 5 };
+
+// DWARF registers (x86-64)
+const uint16_t DWARF_RBP = 6;
+const uint16_t DWARF_RSP = 7;
+
+template <typename T>
+T read(const uint8_t*& p) {
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    p += sizeof(T);
+    return value;
+}
+
+const uint8_t* alignTo8(const uint8_t* p) { return (const uint8_t*)(((uintptr_t)p + 7) & ~(uintptr_t)7); }
+
+[[noreturn]] void fatal(const char* message) {
+    std::fprintf(stderr, "[eva-gc]: %s\n", message);
+    std::abort();
+}
+
+/*
+  Indexes the call site records by return address.
+*/
+void parseStackMaps() {
+    if (__LLVM_StackMaps == nullptr) {
+        return;
+    }
+
+    auto p = __LLVM_StackMaps;
+
+    if (read<uint8_t>(p) != 3) {
+        fatal("unsupported stack map version");
+    }
+    p += 3;
+
+    auto numFunctions = read<uint32_t>(p);
+    auto numConstants = read<uint32_t>(p);
+    read<uint32_t>(p);
+
+    // { address, stack size, record count }
+    auto functions = p;
+    p += numFunctions * 24 + numConstants * 8;
+
+    for (uint32_t f = 0; f < numFunctions; f++) {
+        auto fn = functions + f * 24;
+        auto address = read<uint64_t>(fn);
+        read<uint64_t>(fn);
+        auto recordCount = read<uint64_t>(fn);
+
+        for (uint64_t r = 0; r < recordCount; r++) {
+            auto record = p;
+
+            read<uint64_t>(p);
+            auto offset = read<uint32_t>(p);
+            read<uint16_t>(p);
+            auto numLocations = read<uint16_t>(p);
+            p += numLocations * 12;
+
+            // live-outs
+            p = alignTo8(p);
+            read<uint16_t>(p);
+            auto numLiveOuts = read<uint16_t>(p);
+            p = alignTo8(p + numLiveOuts * 4);
+
+            callSites[address + offset] = record;
+        }
+    }
+}
+
+struct Location {
+    uint8_t type;
+    uint16_t reg;
+    int32_t offset;
+};
+
+Location readLocation(const uint8_t* p) {
+    Location location;
+    location.type = read<uint8_t>(p);
+    read<uint8_t>(p);
+    read<uint16_t>(p);
+    location.reg = read<uint16_t>(p);
+    read<uint16_t>(p);
+    location.offset = read<int32_t>(p);
+    return location;
+}
+
+/*
+  Address of the stack slot of a gc pointer, in a frame.
+*/
+void** slotAddress(const Location& location, char* sp, char* fp) {
+    if (location.type != INDIRECT) {
+        fatal("gc pointer not spilled to the stack");
+    }
+
+    switch (location.reg) {
+        case DWARF_RSP:
+            return (void**)(sp + location.offset);
+        case DWARF_RBP:
+            return (void**)(fp + location.offset);
+        default:
+            fatal("unsupported stack map register");
+    }
+}
+
+/*
+  Calls `relocate` on the gc pointers of the Eva frames, starting with
+  the caller of the runtime frame `frame`. Derived pointers (into an
+  object) move with their base.
+*/
+template <typename Relocate>
+void visitStack(void** frame, Relocate relocate) {
+    struct Root {
+        void** base;
+        void** derived;
+        char* baseValue;
+        char* derivedValue;
+    };
+
+    std::vector<Root> roots;
+
+    // [frame] is the frame pointer of the caller, [frame + 1] the return address
+    while (frame != nullptr) {
+        auto it = callSites.find((uintptr_t)frame[1]);
+        if (it == callSites.end()) {
+            return;
+        }
+
+        auto sp = (char*)(frame + 2);
+        auto fp = (char*)frame[0];
+
+        // statepoint locations: calling convention, flags, deopt count,
+        // the deopt values, then (base, derived) pairs
+        auto p = it->second + 14;
+        auto numLocations = read<uint16_t>(p);
+        auto numDeopt = readLocation(p + 2 * 12).offset;
+
+        // read all the pairs first: a slot can be the base of several of them
+        roots.clear();
+        for (auto i = 3 + numDeopt; i + 1 < numLocations; i += 2) {
+            auto base = slotAddress(readLocation(p + i * 12), sp, fp);
+            auto derived = slotAddress(readLocation(p + (i + 1) * 12), sp, fp);
+            roots.push_back({base, derived, (char*)*base, (char*)*derived});
+        }
+
+        for (auto& root : roots) {
+            auto moved = (char*)relocate(root.baseValue);
+            *root.derived = moved + (root.derivedValue - root.baseValue);
+            *root.base = moved;
+        }
+
+        frame = (void**)fp;
+    }
+}
+
+const EvaClassDescriptor* classOf(const void* object) {
+    // the vTable starts with the class descriptor
+    return **(EvaClassDescriptor***)object;
+}
+
+uint64_t sizeOf(const void* object) {
+    auto cls = classOf(object);
+    return cls->elementSize == 0 ? cls->size : evaArraySize(cls, ((const EvaArray*)object)->length);
+}
+
+/*
+  The objects are forwarded by replacing their vTable pointer
+  with the new address, tagged (vTables are aligned).
+*/
+bool isForwarded(const void* object) { return *(uintptr_t*)object & 1; }
+
+void* forwardee(const void* object) { return (void*)(*(uintptr_t*)object & ~(uintptr_t)1); }
+
+/*
+  Copies an object to the end of a space, once.
+*/
+void* copy(void* object, Space& to) {
+    if (isForwarded(object)) {
+        return forwardee(object);
+    }
+
+    auto size = sizeOf(object);
+    auto copy = to.top;
+    to.top += size;
+
+    std::memcpy(copy, object, size);
+    *(uintptr_t*)object = (uintptr_t)copy | 1;
+
+    return copy;
+}
+
+template <typename Relocate>
+void visitFields(char* object, Relocate relocate) {
+    auto cls = classOf(object);
+    auto fields = (void**)object;
+
+    for (uint64_t word = 0; word < cls->size / 8; word++) {
+        if (cls->pointers[word / 64] & (1ull << (word % 64))) {
+            fields[word] = relocate(fields[word]);
+        }
+    }
+
+    // arrays of objects
+    if (cls->elementPointers) {
+        auto elements = (void**)(object + cls->size);
+        for (int64_t i = 0; i < ((EvaArray*)object)->length; i++) {
+            elements[i] = relocate(elements[i]);
+        }
+    }
+}
+
+/*
+  Cheney scan: the fields of the objects copied to [scan, to.top)
+  are relocated, which copies the objects they reach.
+*/
+template <typename Relocate>
+void scan(char* scan, Space& to, Relocate relocate) {
+    while (scan < to.top) {
+        visitFields(scan, relocate);
+        scan += sizeOf(scan);
+    }
+}
+
+void resetYoung() {
+    // the objects are allocated zeroed
+    std::memset(young.start, 0, young.used());
+
+    young.top = young.start;
+    eva_gc_young.cursor = young.start;
+}
+
+/*
+  Minor collection: the young objects reachable from the stack and
+  the remembered set are promoted to the old generation, which has
+  room for all of them.
+*/
+void collectYoung(void** frame) {
+    auto promote = [](void* object) -> void* {
+        return young.contains(object) ? copy(object, old) : object;
+    };
+
+    auto scanStart = old.top;
+
+    visitStack(frame, promote);
+
+    for (auto field : rememberedSet) {
+        *field = promote(*field);
+    }
+    rememberedSet.clear();
+
+    scan(scanStart, old, promote);
+
+    resetYoung();
+}
+
+char* mapSpace(uint64_t size) {
+    auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        fatal("out of memory");
+    }
+    return (char*)memory;
+}
+
+/*
+  Major collection: the live objects of both generations are evacuated
+  to a new old generation, twice their size plus `extra` bytes (the
+  pages are only touched when used).
+*/
+void collectAll(void** frame, uint64_t extra) {
+    auto reserved = std::max(EVA_GC_OLD_MIN_SIZE, 2 * (old.used() + young.used() + extra) + EVA_GC_YOUNG_SIZE);
+
+    toSpace.start = toSpace.top = mapSpace(reserved);
+    toSpace.end = toSpace.start + reserved;
+    toSpace.mapped = reserved;
+
+    auto evacuate = [](void* object) -> void* {
+        return young.contains(object) || old.contains(object) ? copy(object, toSpace) : object;
+    };
+
+    visitStack(frame, evacuate);
+
+    // the old objects are only live if reachable
+    rememberedSet.clear();
+
+    scan(toSpace.start, toSpace, evacuate);
+
+    munmap(old.start, old.mapped);
+
+    auto live = toSpace.used();
+    auto size = std::max(EVA_GC_OLD_MIN_SIZE, 2 * (live + extra) + EVA_GC_YOUNG_SIZE);
+
+    old = toSpace;
+    old.end = old.start + std::min(size, reserved);
+
+    resetYoung();
+}
+
+void printStats() {
+    std::fprintf(stderr,
+                 "[eva-gc] minor: %llu (%.3f ms), major: %llu (%.3f ms), max pause: %.3f ms, old: %llu KB\n",
+                 (unsigned long long)stats.minor, stats.minorPause, (unsigned long long)stats.major,
+                 stats.majorPause, stats.maxPause, (unsigned long long)(old.used() / 1024));
+}
+
+void init() {
+    uint64_t youngSize = EVA_GC_YOUNG_SIZE;
+
+    if (auto kb = std::getenv("EVA_GC_YOUNG_KB")) {
+        youngSize = std::max(1ull, std::strtoull(kb, nullptr, 10)) * 1024;
+    }
+
+    if (std::getenv("EVA_GC_STATS")) {
+        std::atexit(printStats);
+    }
+
+    young.start = young.top = mapSpace(youngSize);
+    young.end = young.start + youngSize;
+    young.mapped = youngSize;
+
+    eva_gc_young = {young.start, young.end};
+
+    old.start = old.top = mapSpace(EVA_GC_OLD_MIN_SIZE);
+    old.end = old.start + EVA_GC_OLD_MIN_SIZE;
+    old.mapped = EVA_GC_OLD_MIN_SIZE;
+
+    parseStackMaps();
+}
+
+/*
+  Collects, the old generation gets room for `extra` more bytes.
+*/
+void collect(void** frame, uint64_t extra) {
+    auto start = std::chrono::steady_clock::now();
+
+    young.top = eva_gc_young.cursor;
+    bool major = old.free() < young.used() + extra;
+
+    if (major) {
+        collectAll(frame, extra);
+    } else {
+        collectYoung(frame);
+    }
+
+    auto pause = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    (major ? stats.majorPause : stats.minorPause) += pause;
+    (major ? stats.major : stats.minor)++;
+    stats.maxPause = std::max(stats.maxPause, pause);
+}
+
+/*
+  Allocates `size` bytes, zeroed, `frame` is the runtime frame
+  called from Eva code. Inlined into it: the frame stays live.
+*/
+[[gnu::always_inline]] inline char* allocate(void** frame, uint64_t size) {
+    if (young.start == nullptr) {
+        init();
+    }
+
+    // large objects go to the old generation directly
+    if (size > young.mapped / 8) {
+        if (old.free() < size) {
+            collect(frame, size);
+        }
+
+        auto object = old.top;
+        old.top += size;
+        return (char*)std::memset(object, 0, size);
+    }
+
+    if (eva_gc_young.cursor + size > eva_gc_young.limit) {
+        collect(frame, 0);
+    }
+
+    auto object = eva_gc_young.cursor;
+    eva_gc_young.cursor += size;
+    return object;
+}
+
+}  // namespace
+
+// the callers are Eva functions: their frames are walked from the runtime frame
+
+void* eva_gc_alloc_slow(EvaClassDescriptor* cls) {
+    return allocate((void**)__builtin_frame_address(0), cls->size);
+}
+
+void* eva_gc_alloc_array(EvaClassDescriptor* cls, int64_t length) {
+    auto array = (EvaArray*)allocate((void**)__builtin_frame_address(0), evaArraySize(cls, length));
+    array->length = length;
+    return array;
+}
+
+void eva_gc_write_barrier(void** field) {
+    if (!young.contains(field) && young.contains(*field)) {
+        rememberedSet.push_back(field);
+    }
+}
+
+void eva_array_index_error(int64_t index, int64_t length) {
+    evaArrayIndexError(index, length);
+}
@@ -0,0 +1,47 @@
+/*
+    Eva precise collector (--precise-gc), used instead of libgc.
+
+    Generational and copying: objects are bump-allocated in the young
+    generation (the compiler emits the fast path inline, as for the
+    class nurseries), the survivors of a minor collection are promoted
+    to the old generation, a semispace which is evacuated (and resized)
+    by the major collections. The live objects are copied next to each
+    other, in the order they are reached.
+
+    The collector is precise: the compiler marks the functions with the
+    "statepoint-example" strategy, and LLVM records the stack slots of
+    the live object pointers at each call in the stack maps. The
+    layout of an object comes from its class descriptor, the first
+    entry of its vTable. Stores of object pointers into fields go
+    through a write barrier, which remembers the old -> young pointers.
+*/
+#ifndef EvaGC_h
+#define EvaGC_h
+
+#include "./EvaRuntime.h"
+
+extern "C" {
+
+// the young generation: [cursor, limit) is free
+extern EvaNursery eva_gc_young;
+
+// allocates an object when the young generation is full: collects it,
+// large objects are allocated in the old generation
+void* eva_gc_alloc_slow(EvaClassDescriptor* cls);
+
+// allocates an array of `length` elements, in the young generation
+// unless it's large
+void* eva_gc_alloc_array(EvaClassDescriptor* cls, int64_t length);
+
+// records the store of a young object pointer into an old object
+void eva_gc_write_barrier(void** field);
+
+}
+
+// default size of the young generation, EVA_GC_YOUNG_KB overrides it
+static const uint64_t EVA_GC_YOUNG_SIZE = 4 * 1024 * 1024;
+
+// minimal size of the old generation
+static const uint64_t EVA_GC_OLD_MIN_SIZE = 16 * 1024 * 1024;
+
+#endif
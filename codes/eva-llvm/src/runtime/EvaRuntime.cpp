@@ -0,0 +1,51 @@
+/*
+    Eva runtime library, linked with the compiled programs:
+
+      clang++ -O2 -std=c++17 -c src/runtime/EvaRuntime.cpp -o ./bin/EvaRuntime.o
+      cc ./bin/out.o ./bin/EvaRuntime.o <libgc> -o ./bin/out
+
+    Programs run with the JIT use the same runtime from the eva-llvm
+    process (see EvaJIT).
+*/
+#include "./EvaRuntime.h"
+
+// libgc (gc.h, gc_typed.h, gc_inline.h, gc_mark.h): GC_word and GC_descr are words
+extern "C" {
+void* GC_malloc(size_t size);
+void* GC_malloc_atomic(size_t size);
+uint64_t GC_make_descriptor(const uint64_t* bitmap, size_t words);
+void* GC_malloc_explicitly_typed(size_t size, uint64_t descr);
+void GC_generic_malloc_many(size_t size, int kind, void** list);
+size_t GC_size(const void* object);
+void GC_add_roots(void* low, void* high);
+void** GC_new_free_list(void);
+unsigned GC_new_kind(void** freeList, uint64_t descr, int addSizeToDescr, int clearNewObjects);
+}
+
+static const EvaGC gc = {
+    GC_malloc,
+    GC_malloc_atomic,
+    GC_make_descriptor,
+    GC_malloc_explicitly_typed,
+    GC_generic_malloc_many,
+    GC_size,
+    GC_add_roots,
+    GC_new_free_list,
+    GC_new_kind,
+};
+
+void* eva_alloc_class_slow(EvaNursery* nursery, EvaClassDescriptor* cls) {
+    return evaAllocClassSlow(gc, nursery, cls);
+}
+
+void* eva_alloc_class(EvaClassDescriptor* cls) {
+    return evaAllocClass(gc, cls);
+}
+
+void* eva_alloc_array(EvaClassDescriptor* cls, int64_t length) {
+    return evaAllocArray(gc, cls, length);
+}
+
+void eva_array_index_error(int64_t index, int64_t length) {
+    evaArrayIndexError(index, length);
+}
@@ -0,0 +1,354 @@
+/*
+    Eva runtime: object and array allocation.
+
+    Each class has a thread-local nursery, objects are bump-allocated
+    from it: the compiler emits the fast path inline (bump the cursor
+    by the stride, check the limit), and calls eva_alloc_class_slow
+    only when the buffer is full. The buffer is a run of free objects
+    next to each other, taken from a list the collector allocates in
+    one call (GC_generic_malloc_many): each object is reclaimed on its
+    own. Pointer-free classes aren't scanned at all, the others are
+    allocated from an object kind of their collector descriptor
+    (GC_new_kind), so they are scanned precisely as well. The objects
+    of the buffer are kept alive by the nursery until they are handed
+    out.
+
+    Arrays are objects too: a vTable (for the descriptor), the length,
+    then the elements, unboxed.
+*/
+#ifndef EvaRuntime_h
+#define EvaRuntime_h
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+extern "C" {
+
+/*
+  Allocation buffer of a thread: [cursor, limit) is free.
+  The compiler relies on this layout.
+*/
+struct EvaNursery {
+    char* cursor;
+    char* limit;
+
+    // distance between the objects of the buffer, at least their size
+    uint64_t stride;
+
+    // the current list of free objects, which keeps them alive
+    // until they are handed out (the collector doesn't see the
+    // objects in the buffer), its length and its capacity
+    void** objects;
+    uint64_t count;
+    uint64_t capacity;
+
+    // the buffer holds the objects [first, next) of the list
+    uint64_t first;
+    uint64_t next;
+};
+
+/*
+  Layout of a class for the collector, emitted by the compiler
+  (see EvaLLVM::buildClassDescriptor), it relies on this layout.
+  The first entry of the class vTable points to it.
+*/
+struct EvaClassDescriptor {
+    // object size in bytes, a multiple of 8
+    uint64_t size;
+
+    // bit i is set when the word i of the object is a pointer
+    // to the heap (the vTable is not), all zero when pointer-free
+    const uint64_t* pointers;
+
+    // collector descriptor, built on the first allocation
+    uint64_t gcDescr;
+    uint64_t hasGCDescr;
+
+    // arrays: size of the elements, which follow the `size` bytes
+    // of header (vTable and length), 0 for classes
+    uint64_t elementSize;
+
+    // arrays: whether the elements point to the heap
+    uint64_t elementPointers;
+
+    // object kind of the collector descriptor, set with it:
+    // 0 when the objects are typed one by one
+    uint64_t gcKind;
+};
+
+/*
+  Header of the arrays, the elements follow.
+  The compiler relies on this layout.
+*/
+struct EvaArray {
+    void* vTable;
+    int64_t length;
+};
+
+// allocates an object when the nursery of its class is full: refills it
+void* eva_alloc_class_slow(EvaNursery* nursery, EvaClassDescriptor* cls);
+
+// allocates an object out of the nursery (large objects)
+void* eva_alloc_class(EvaClassDescriptor* cls);
+
+// allocates an array of `length` elements, zeroed, the length is set
+void* eva_alloc_array(EvaClassDescriptor* cls, int64_t length);
+
+// reports an array access out of bounds, and exits
+[[noreturn]] void eva_array_index_error(int64_t index, int64_t length);
+
+}
+
+/*
+  The collector functions used by the runtime: libgc, or
+  in-process fallbacks for the JIT when it isn't available.
+*/
+struct EvaGC {
+    void* (*malloc)(size_t size);
+    void* (*mallocAtomic)(size_t size);
+    uint64_t (*makeDescriptor)(const uint64_t* bitmap, size_t words);
+    void* (*mallocTyped)(size_t size, uint64_t descr);
+
+    // a list of free objects of a kind, linked by their first word
+    void (*mallocMany)(size_t size, int kind, void** list);
+
+    // size of an object as allocated, 0 when unknown
+    size_t (*size)(const void* object);
+
+    void (*addRoots)(void* low, void* high);
+
+    // a new object kind, marked with a descriptor (gc_mark.h)
+    void** (*newFreeList)();
+    unsigned (*newKind)(void** freeList, uint64_t descr, int addSizeToDescr, int clearNewObjects);
+};
+
+// object kind of the pointer-free lists (gc_mark.h): GC_I_PTRFREE
+static const int EVA_GC_KIND_POINTER_FREE = 0;
+
+// tags of the collector descriptors (gc_mark.h): only the length
+// and bitmap descriptors can mark the objects of a kind, the others
+// need the type of each object
+static const uint64_t EVA_GC_DS_TAGS = 3;
+static const uint64_t EVA_GC_DS_LENGTH = 0;
+static const uint64_t EVA_GC_DS_BITMAP = 1;
+
+// libgc has a few object kinds (MAXOBJKINDS): past this many
+// descriptors, the objects are typed one by one
+static const uint64_t EVA_GC_MAX_KINDS = 8;
+
+// larger objects bypass the nursery
+static const uint64_t EVA_NURSERY_MAX_OBJECT_SIZE = 4 * 1024;
+
+// objects are aligned to 8 bytes
+static const uint64_t EVA_OBJECT_ALIGNMENT = 8;
+
+inline bool evaIsPointerFree(const EvaClassDescriptor* cls) {
+    for (uint64_t i = 0; i < (cls->size / 8 + 63) / 64; i++) {
+        if (cls->pointers[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+  Object kinds of the nursery lists, by collector descriptor:
+  the classes with the same layout share a kind.
+*/
+struct EvaGCKinds {
+    std::mutex lock;
+    uint64_t count = 0;
+    uint64_t descrs[EVA_GC_MAX_KINDS];
+    uint64_t kinds[EVA_GC_MAX_KINDS];
+};
+
+inline EvaGCKinds evaGCKinds;
+
+/*
+  Kind of the objects with a collector descriptor, 0 if there
+  is none (the descriptor is per object, or out of kinds).
+*/
+inline uint64_t evaGCKind(const EvaGC& gc, uint64_t descr) {
+    auto tag = descr & EVA_GC_DS_TAGS;
+    if (tag != EVA_GC_DS_LENGTH && tag != EVA_GC_DS_BITMAP) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> guard(evaGCKinds.lock);
+
+    for (uint64_t i = 0; i < evaGCKinds.count; i++) {
+        if (evaGCKinds.descrs[i] == descr) {
+            return evaGCKinds.kinds[i];
+        }
+    }
+
+    if (evaGCKinds.count == EVA_GC_MAX_KINDS) {
+        return 0;
+    }
+
+    // the descriptor covers the object: no size to add, the new objects are zeroed
+    auto kind = gc.newKind(gc.newFreeList(), descr, 0, 1);
+
+    evaGCKinds.descrs[evaGCKinds.count] = descr;
+    evaGCKinds.kinds[evaGCKinds.count] = kind;
+    evaGCKinds.count++;
+
+    return kind;
+}
+
+inline uint64_t evaGCDescr(const EvaGC& gc, EvaClassDescriptor* cls) {
+    if (!cls->hasGCDescr) {
+        cls->gcDescr = gc.makeDescriptor(cls->pointers, cls->size / 8);
+        cls->gcKind = evaGCKind(gc, cls->gcDescr);
+        cls->hasGCDescr = 1;
+    }
+    return cls->gcDescr;
+}
+
+/*
+  Exits when the collector is out of memory.
+*/
+inline void* evaCheckAllocation(void* memory) {
+    if (memory == nullptr) {
+        std::fprintf(stderr, "[eva]: out of memory\n");
+        std::exit(1);
+    }
+    return memory;
+}
+
+/*
+  Allocates one object of a class, zeroed.
+*/
+inline void* evaAllocClass(const EvaGC& gc, EvaClassDescriptor* cls) {
+    if (evaIsPointerFree(cls)) {
+        return std::memset(evaCheckAllocation(gc.mallocAtomic(cls->size)), 0, cls->size);
+    }
+
+    return evaCheckAllocation(gc.mallocTyped(cls->size, evaGCDescr(gc, cls)));
+}
+
+/*
+  Slow path of the allocation: the next run of free objects of the
+  list becomes the buffer, a new list is allocated once it's used up.
+  The objects next to each other may be listed in either order.
+  Pointer-free objects are zeroed here, the collector zeroes the
+  others (but the link, where the vTable goes).
+*/
+inline void* evaAllocClassSlow(const EvaGC& gc, EvaNursery* nursery, EvaClassDescriptor* cls) {
+    if (cls->size > EVA_NURSERY_MAX_OBJECT_SIZE) {
+        return evaAllocClass(gc, cls);
+    }
+
+    auto pointerFree = evaIsPointerFree(cls);
+
+    // the classes without a kind of their own are never scanned
+    // conservatively: typed one by one, the nursery stays empty
+    if (!pointerFree) {
+        evaGCDescr(gc, cls);
+        if (cls->gcKind == 0) {
+            return evaAllocClass(gc, cls);
+        }
+    }
+
+    // the nursery is thread-local: registered for the collector
+    if (nursery->objects == nullptr) {
+        gc.addRoots(nursery, nursery + 1);
+    }
+
+    // the objects of the buffer are all handed out
+    for (auto i = nursery->first; i < nursery->next; i++) {
+        nursery->objects[i] = nullptr;
+    }
+
+    if (nursery->next == nursery->count) {
+        void* list = nullptr;
+        gc.mallocMany(cls->size, pointerFree ? EVA_GC_KIND_POINTER_FREE : cls->gcKind, &list);
+        evaCheckAllocation(list);
+
+        uint64_t count = 0;
+        for (auto object = list; object != nullptr; object = *(void**)object) {
+            count++;
+        }
+
+        if (count > nursery->capacity) {
+            nursery->objects = (void**)evaCheckAllocation(gc.malloc(count * sizeof(void*)));
+            nursery->capacity = count;
+        }
+        nursery->count = count;
+        nursery->next = 0;
+
+        count = 0;
+        for (auto object = list; object != nullptr; object = *(void**)object) {
+            nursery->objects[count++] = object;
+        }
+
+        auto stride = gc.size(list);
+        nursery->stride = stride != 0 ? stride : cls->size;
+    }
+
+    // the run of objects at the head of the list
+    auto stride = nursery->stride;
+    auto i = nursery->next;
+    auto low = (char*)nursery->objects[i];
+    auto high = low;
+
+    for (i++; i < nursery->count; i++) {
+        auto object = (char*)nursery->objects[i];
+        if (object == low - stride) {
+            low = object;
+        } else if (object == high + stride) {
+            high = object;
+        } else {
+            break;
+        }
+    }
+
+    nursery->first = nursery->next;
+    nursery->next = i;
+
+    if (pointerFree) {
+        std::memset(low, 0, high - low + cls->size);
+    }
+
+    nursery->cursor = low + stride;
+    nursery->limit = high + stride;
+
+    return low;
+}
+
+/*
+  Size of an array of `length` elements in bytes, a multiple of 8.
+*/
+inline uint64_t evaArraySize(const EvaClassDescriptor* cls, int64_t length) {
+    if (length < 0) {
+        std::fprintf(stderr, "[eva]: negative array length %lld\n", (long long)length);
+        std::exit(1);
+    }
+
+    auto size = cls->size + (uint64_t)length * cls->elementSize;
+    return (size + EVA_OBJECT_ALIGNMENT - 1) & ~(EVA_OBJECT_ALIGNMENT - 1);
+}
+
+/*
+  Allocates an array: the elements of pointer-free arrays
+  are never scanned.
+*/
+inline void* evaAllocArray(const EvaGC& gc, EvaClassDescriptor* cls, int64_t length) {
+    auto size = evaArraySize(cls, length);
+    auto array = (EvaArray*)(cls->elementPointers ? evaCheckAllocation(gc.malloc(size))
+                                                  : std::memset(evaCheckAllocation(gc.mallocAtomic(size)), 0, size));
+    array->length = length;
+    return array;
+}
+
+[[noreturn]] inline void evaArrayIndexError(int64_t index, int64_t length) {
+    std::fprintf(stderr, "[eva]: array index %lld out of bounds, length %lld\n", (long long)index,
+                 (long long)length);
+    std::exit(1);
+}
+
+#endif